@@ -54,7 +54,11 @@
 #include "assert.h"
 #include "input.h"
 #include "modex.h"
+#include "pack.h"
 #include "photo.h"
+#include "photo_cache.h"
+#include "photo_store.h"
+#include "quantize.h"
 #include "text.h"
 #include "world.h"
 
@@ -179,6 +183,7 @@ static const typed_cmd_t cmd_list[] = {
 /* local functions--see function headers for details */
 
 static void cancel_status_thread (void* ignore);
+static void draw_exposed (int32_t x, int32_t y, int32_t w, int32_t h);
 static game_condition_t game_loop (void);
 static int32_t handle_typing (void);
 static void init_game (void);
@@ -287,6 +292,9 @@ game_loop ()
 	    /* Adjust colors and photo drawing for the current room photo. */
 	    prep_room (game_info.where);
 
+	    /* Start reading photos of rooms the player may enter next. */
+	    prefetch_neighbors (game_info.where);
+
 	    /* Draw the room (calls show. */
 	    redraw_room ();
 
@@ -294,6 +302,11 @@ game_loop ()
 	    enter_room = 0;
 	}
 
+	/* Redraw with the room photo's own colors once they are ready. */
+	if (refine_room ()) {
+	    redraw_room ();
+	}
+
 	show_screen ();
 	/*My CODE*/
 	pthread_mutex_lock (&msg_lock);
@@ -539,6 +552,30 @@ init_game ()
 }
 
 
+/* 
+ * draw_exposed
+ *   DESCRIPTION: Draw a strip of the screen exposed by moving the photo.
+ *                A strip one line wide is drawn as that line, which
+ *                costs less than filling it as a rectangle.
+ *   INPUTS: (x,y) -- upper left pixel of strip within the scroll region
+ *           (w,h) -- width and height of strip
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void
+draw_exposed (int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    if (1 == w && SCROLL_Y_DIM == h) {
+	(void)draw_vert_line (x);
+    } else if (1 == h && SCROLL_X_DIM == w) {
+	(void)draw_horiz_line (y);
+    } else {
+	(void)draw_rect (x, y, w, h);
+    }
+}
+
+
 /* 
  * move_photo_down
  *   DESCRIPTION: Move background photo down one or more pixels.  Amount of
@@ -553,7 +590,6 @@ static void
 move_photo_down ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
     delta = (game_info.y_speed > game_info.map_y ?
@@ -564,9 +600,7 @@ move_photo_down ()
     set_view_window (game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-	(void)draw_horiz_line (idx);
-    }
+    draw_exposed (0, 0, SCROLL_X_DIM, delta);
 }
 
 
@@ -584,7 +618,6 @@ static void
 move_photo_left ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_width (game_info.where) - SCROLL_X_DIM -
@@ -596,9 +629,7 @@ move_photo_left ()
     set_view_window (game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-	(void)draw_vert_line (SCROLL_X_DIM - idx);
-    }
+    draw_exposed (SCROLL_X_DIM - delta, 0, delta, SCROLL_Y_DIM);
 }
 
 
@@ -616,7 +647,6 @@ static void
 move_photo_right ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
     delta = (game_info.x_speed > game_info.map_x ?
@@ -627,9 +657,7 @@ move_photo_right ()
     set_view_window (game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-	(void)draw_vert_line (idx);
-    }
+    draw_exposed (0, 0, delta, SCROLL_Y_DIM);
 }
 
 
@@ -647,7 +675,6 @@ static void
 move_photo_up ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_height (game_info.where) - SCROLL_Y_DIM - 
@@ -659,9 +686,7 @@ move_photo_up ()
     set_view_window (game_info.map_x, game_info.map_y);
 
     /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-	(void)draw_horiz_line (SCROLL_Y_DIM - idx);
-    }
+    draw_exposed (0, SCROLL_Y_DIM - delta, SCROLL_X_DIM, delta);
 }
 
 
@@ -676,12 +701,8 @@ move_photo_up ()
 static void
 redraw_room ()
 {
-    int32_t i; /* index over rows */
-
-    /* Draw all lines in the scroll region. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
-	(void)draw_horiz_line (i);
-    }
+    /* Draw the whole scroll region at once. */
+    (void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
 }
 
 
@@ -855,6 +876,13 @@ main ()
 	//ioctl(fd, TUX_SET_LED, 0x0F0F1234);
 
     game_condition_t game;  /* outcome of playing */
+    struct timeval build_start, build_end; /* time taken by build_world */
+    const char* quantizer;  /* photo quantizer requested at run time  */
+    const char* cache_dir;  /* quantized photo cache directory        */
+    const char* threads;    /* image loading threads requested        */
+    const char* budget;     /* room photo memory budget requested     */
+    const char* pack;       /* asset pack file name                   */
+    const char* progressive; /* progressive photo loading requested */
 
     /* Randomize for more fun (remove for deterministic layout). */
     srand (time (NULL));
@@ -862,7 +890,68 @@ main ()
     /* Provide some protection against fatal errors. */
     clean_on_signals ();
 
+    /* Let the photo quantizer be chosen at run time. */
+    if (NULL != (quantizer = getenv ("ADVENTURE_QUANTIZER")) &&
+	0 != quantize_set_method (quantizer)) {
+	PANIC ("unknown ADVENTURE_QUANTIZER method");
+    }
+
+    /* 
+     * Keep the quantized photo cache in the user's cache directory unless
+     * it is moved (or disabled with "").
+     */
+    if (NULL != (cache_dir = getenv ("ADVENTURE_CACHE_DIR"))) {
+	photo_cache_set_dir (cache_dir);
+    } else {
+	photo_cache_use_user_dir ();
+    }
+
+    /* Let the number of image loading threads be chosen at run time. */
+    if (NULL != (threads = getenv ("ADVENTURE_LOAD_THREADS"))) {
+	if (0 > atoi (threads)) {
+	    PANIC ("bad ADVENTURE_LOAD_THREADS count");
+	}
+	world_set_load_threads (atoi (threads));
+    }
+
+    /* Let the room photo memory budget (in bytes) be set at run time. */
+    if (NULL != (budget = getenv ("ADVENTURE_PHOTO_BUDGET"))) {
+	photo_store_set_budget (strtoul (budget, NULL, 10));
+    }
+
+    /* 
+     * Read images through the asset pack if there is one.  A pack named
+     * at run time must exist; "" means use only separate files.
+     */
+    if (NULL != (pack = getenv ("ADVENTURE_PACK"))) {
+	if ('\0' != pack[0] && 0 != pack_open (pack)) {
+	    PANIC ("can't open ADVENTURE_PACK");
+	}
+    } else {
+	(void)pack_open (ASSET_PACK);
+    }
+
+    /* 
+     * Let progressive loading of room photos be turned on at run time.
+     * Only photos read during the game are shown early, so this needs an
+     * ADVENTURE_PHOTO_BUDGET: with a budget of 0 (the default), build_world
+     * reads and quantizes every photo before the game starts.
+     */
+    progressive = getenv ("ADVENTURE_PROGRESSIVE");
+    if (NULL != progressive && 0 != atoi (progressive) &&
+	0 == photo_store_budget ()) {
+	PANIC ("ADVENTURE_PROGRESSIVE needs an ADVENTURE_PHOTO_BUDGET");
+    }
+
+    /* Build the world, reporting how long it took to load all images. */
+    (void)gettimeofday (&build_start, NULL);
     if (!build_world ()) {PANIC ("can't build world");}
+    (void)gettimeofday (&build_end, NULL);
+    printf ("build_world took %ld ms (%s quantizer, %d threads)\n", 
+	    (build_end.tv_sec - build_start.tv_sec) * 1000L +
+	    (build_end.tv_usec - build_start.tv_usec) / 1000L,
+	    quantize_method_name (quantize_get_method ()),
+	    world_load_threads ());
     init_game ();
 
     /* Perform sanity checks. */
@@ -882,6 +971,8 @@ main ()
 	if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer)) {
 	    PANIC ("cannot initialize mode X");
 	}
+	set_rect_fill (fill_rect_buffer);
+	set_planar_fill (fill_planar_buffer);
 	push_cleanup ((cleanup_fn_t)clear_mode_X, NULL); {
 
 	    /* Initialize the keyboard and/or Tux controller. */
@@ -890,7 +981,32 @@ main ()
 	    }
 	    push_cleanup ((cleanup_fn_t)shutdown_input, NULL); {
 
-		game = game_loop ();
+		/* 
+		 * Read photos of nearby rooms in the background unless all
+		 * photos are kept in memory anyway.
+		 */
+		if (0 != photo_store_budget () && 
+		    0 != photo_store_start_prefetch ()) {
+		    PANIC ("cannot start photo prefetch thread");
+		}
+		push_cleanup ((cleanup_fn_t)photo_store_stop_prefetch, 
+			      NULL); {
+
+		    /* 
+		     * Show photos read during the game before they are
+		     * quantized, if asked to.
+		     */
+		    if (NULL != progressive && 0 != atoi (progressive) &&
+			0 != photo_start_refine ()) {
+			PANIC ("cannot start photo refinement thread");
+		    }
+		    push_cleanup ((cleanup_fn_t)photo_stop_refine, NULL); {
+
+			game = game_loop ();
+
+		    } pop_cleanup (1);
+
+		} pop_cleanup (1);
 
 	    } pop_cleanup (1);
 
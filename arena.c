@@ -0,0 +1,130 @@
+/*									tab:8
+ *
+ * arena.c - slab allocator for memory freed all at once
+ *
+ * Filename:	    arena.c
+ * History:
+ *	1	First written.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+
+/* types local to this file (declared in arena.h) */
+
+/* a slab; its memory follows this header, which takes one cache line */
+struct arena_slab_t {
+    arena_slab_t* next;		/* next (older) slab in arena    */
+    size_t        size;		/* bytes in slab, header included */
+    size_t        used;		/* bytes handed out, header included */
+};
+
+#define SLAB_HEADER ARENA_LINE	/* bytes reserved for slab header */
+
+
+/*
+ * slab_alloc
+ *   DESCRIPTION: Try to allocate memory from one slab.
+ *   INPUTS: s -- the slab
+ *           size -- bytes needed
+ *           align -- alignment needed
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to memory, or NULL if the slab lacks room
+ *   SIDE EFFECTS: uses up space in the slab
+ */
+static void*
+slab_alloc (arena_slab_t* s, size_t size, size_t align)
+{
+    size_t start;	/* offset of allocation in slab */
+
+    start = (s->used + align - 1) & ~(align - 1);
+    if (s->size < start || s->size - start < size) {
+	return NULL;
+    }
+    s->used = start + size;
+    return (uint8_t*)s + start;
+}
+
+
+/*
+ * arena_alloc
+ *   DESCRIPTION: Allocate memory from an arena, adding a slab if no 
+ *                existing slab has room.
+ *   INPUTS: a -- the arena
+ *           size -- bytes needed
+ *           align -- alignment needed (a power of two, at most ARENA_PAGE)
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to memory, or NULL on failure
+ *   SIDE EFFECTS: may allocate a slab
+ */
+void*
+arena_alloc (arena_t* a, size_t size, size_t align)
+{
+    arena_slab_t* s;	/* loop index over slabs / new slab */
+    void*         mem;	/* memory allocated                 */
+    size_t        need;	/* size of new slab                 */
+
+    for (s = a->slabs; NULL != s; s = s->next) {
+	if (NULL != (mem = slab_alloc (s, size, align))) {
+	    return mem;
+	}
+    }
+
+    /* Add a slab big enough for the request, rounded up to whole pages. */
+    need = SLAB_HEADER + size + align;
+    if (need < a->slab_size) {
+	need = a->slab_size;
+    }
+    need = (need + ARENA_PAGE - 1) & ~(size_t)(ARENA_PAGE - 1);
+    if (0 != posix_memalign ((void**)&s, ARENA_PAGE, need)) {
+	return NULL;
+    }
+    s->size = need;
+    s->used = SLAB_HEADER;
+    s->next = a->slabs;
+    a->slabs = s;
+    return slab_alloc (s, size, align);
+}
+
+
+/*
+ * arena_reset
+ *   DESCRIPTION: Make all of an arena's memory available for reuse.
+ *   INPUTS: a -- the arena
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: all memory allocated from the arena becomes invalid
+ */
+void
+arena_reset (arena_t* a)
+{
+    arena_slab_t* s;	/* loop index over slabs */
+
+    for (s = a->slabs; NULL != s; s = s->next) {
+	s->used = SLAB_HEADER;
+    }
+}
+
+
+/*
+ * arena_release
+ *   DESCRIPTION: Free all of an arena's slabs.
+ *   INPUTS: a -- the arena
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: all memory allocated from the arena becomes invalid
+ */
+void
+arena_release (arena_t* a)
+{
+    arena_slab_t* s;	/* slab being freed */
+
+    while (NULL != (s = a->slabs)) {
+	a->slabs = s->next;
+	free (s);
+    }
+}
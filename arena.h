@@ -0,0 +1,48 @@
+/*									tab:8
+ *
+ * arena.h - slab allocator for memory freed all at once, header file
+ *
+ * Filename:	    arena.h
+ * History:
+ *	1	First written.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+
+#include <stddef.h>
+
+
+/*
+ * An arena hands out memory from large page-aligned slabs.  Individual
+ * allocations are never freed; instead, the whole arena is either reset
+ * (keeping its slabs for reuse) or released.  Arenas do no locking, so
+ * an arena shared by threads needs a lock of its own.
+ */
+#define ARENA_PAGE      4096	/* slab alignment                  */
+#define ARENA_LINE      64	/* cache line size, for alignment  */
+#define ARENA_SLAB_SIZE (1024 * 1024) /* default smallest slab size */
+
+typedef struct arena_slab_t arena_slab_t;
+typedef struct arena_t arena_t;
+struct arena_t {
+    arena_slab_t* slabs;	/* slabs, most recently added first */
+    size_t        slab_size;	/* smallest size for a new slab     */
+};
+
+/* initializer for an empty arena with slabs of at least slab_size bytes */
+#define ARENA_INIT(slab_size) {NULL, (slab_size)}
+
+/*
+ * Allocate size bytes aligned to align (a power of two no larger than
+ * ARENA_PAGE).  Returns NULL on failure.
+ */
+extern void* arena_alloc (arena_t* a, size_t size, size_t align);
+
+/* Make all memory in the arena available again, keeping its slabs. */
+extern void arena_reset (arena_t* a);
+
+/* Free all of the arena's slabs. */
+extern void arena_release (arena_t* a);
+
+#endif /* ARENA_H */
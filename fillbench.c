@@ -0,0 +1,238 @@
+/*									tab:8
+ *
+ * fillbench.c - vertical line fill benchmark
+ *
+ * Filename:	    fillbench.c
+ * History:
+ *	1	First written.
+ */
+
+/*
+ * This file is a standalone utility program that measures how fast the
+ * vertical lines drawn when scrolling sideways can be copied out of a
+ * room, with the room's pixels stored by rows (as in the photo) or by
+ * columns (as in the column-major layer kept with COLUMN_LAYER; see
+ * photo.h).  Usage:
+ *
+ *     fillbench [-n <runs>] <photo file>...
+ *
+ * For each photo, one vertical line of SCROLL_Y_DIM pixels is filled at
+ * every x position across the photo, just as scrolling across the whole
+ * photo would fill them, both ways.  The sweep is repeated <runs> times
+ * (default 20), and the fastest time is reported.  The pixel values do
+ * not matter here, so the low byte of each 5:6:5 pixel is used.
+ *
+ * Output is tab-separated text, one line per photo, after a header line
+ * naming the columns:
+ *
+ *     file      photo file name (or "TOTAL" for the sum over all photos)
+ *     width     photo width in pixels
+ *     height    photo height in pixels
+ *     rows_ns   time per line, reading pixels one row apart
+ *     cols_ns   time per line, copying consecutive pixels
+ *     speedup   rows_ns / cols_ns
+ *
+ * The exit status is 0 on success and 2 if any photo cannot be read.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modex.h"
+#include "photo_headers.h"
+
+
+#define MAX_WIDTH   1024	/* largest photo width accepted  */
+#define MAX_HEIGHT  1024	/* largest photo height accepted */
+#define DEFAULT_RUNS 20		/* runs per photo by default     */
+
+
+// Results for one photo (or the total over several).
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t lines;		// lines filled per sweep
+    double   rows_ms;		// time per sweep reading rows
+    double   cols_ms;		// time per sweep reading columns
+} result_t;
+
+
+// Keep the compiler from optimizing away the copies.
+static volatile uint8_t sink;
+
+
+// Get the time in milliseconds from a monotonic clock.
+static double
+now_ms ()
+{
+    struct timespec ts;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Read a photo's pixels into a row-major buffer of one byte per pixel.
+// Return pointer to pixels on success, or NULL on failure.
+static uint8_t*
+read_pixels (const char* fname, photo_header_t* h)
+{
+    FILE*     in;
+    uint16_t* pix = NULL;
+    uint8_t*  img = NULL;
+    uint32_t  idx;
+
+    if (NULL == (in = fopen (fname, "rb")) ||
+	1 != fread (h, sizeof (*h), 1, in) ||
+	MAX_WIDTH < h->width || MAX_HEIGHT < h->height ||
+	NULL == (pix = malloc (h->width * h->height * sizeof (pix[0]))) ||
+	NULL == (img = malloc (h->width * h->height)) ||
+	1 != fread (pix, h->width * h->height * sizeof (pix[0]), 1, in)) {
+	fprintf (stderr, "%s could not be read as a room photo.\n", fname);
+	free (pix);
+	free (img);
+	if (NULL != in) {
+	    (void)fclose (in);
+	}
+	return NULL;
+    }
+    (void)fclose (in);
+    for (idx = 0; h->width * h->height > idx; idx++) {
+	img[idx] = pix[idx];
+    }
+    free (pix);
+    return img;
+}
+
+// Sweep vertical lines across a row-major image, the way fill_vert_buffer
+// does without a column-major layer.
+static void
+sweep_rows (const uint8_t* img, uint32_t w, uint32_t h)
+{
+    uint8_t  buf[SCROLL_Y_DIM];
+    uint32_t x;
+    uint32_t idx;
+
+    for (x = 0; w > x; x++) {
+	for (idx = 0; SCROLL_Y_DIM > idx; idx++) {
+	    buf[idx] = (h > idx ? img[w * idx + x] : 0);
+	}
+	sink = buf[x % SCROLL_Y_DIM];
+    }
+}
+
+// Sweep vertical lines across a column-major image.
+static void
+sweep_cols (const uint8_t* cols, uint32_t w, uint32_t h)
+{
+    uint8_t  buf[SCROLL_Y_DIM];
+    uint32_t x;
+    uint32_t n = (SCROLL_Y_DIM < h ? SCROLL_Y_DIM : h);
+
+    for (x = 0; w > x; x++) {
+	memcpy (buf, cols + h * x, n);
+	memset (buf + n, 0, SCROLL_Y_DIM - n);
+	sink = buf[x % SCROLL_Y_DIM];
+    }
+}
+
+// Time both sweeps over one photo runs times, keeping the fastest times.
+// Return 0 on success, or -1 on failure.
+static int32_t
+bench_photo (const char* fname, int runs, result_t* r)
+{
+    photo_header_t hdr;
+    uint8_t*       img;
+    uint8_t*       cols;
+    uint32_t       x, y;
+    double         t0, t1, t2;
+    int            run;
+
+    if (NULL == (img = read_pixels (fname, &hdr))) {
+	return -1;
+    }
+    if (NULL == (cols = malloc (hdr.width * hdr.height))) {
+	fprintf (stderr, "out of memory\n");
+	free (img);
+	return -1;
+    }
+    for (y = 0; hdr.height > y; y++) {
+	for (x = 0; hdr.width > x; x++) {
+	    cols[hdr.height * x + y] = img[hdr.width * y + x];
+	}
+    }
+
+    memset (r, 0, sizeof (*r));
+    r->width = hdr.width;
+    r->height = hdr.height;
+    r->lines = hdr.width;
+    for (run = 0; runs > run; run++) {
+	t0 = now_ms ();
+	sweep_rows (img, hdr.width, hdr.height);
+	t1 = now_ms ();
+	sweep_cols (cols, hdr.width, hdr.height);
+	t2 = now_ms ();
+	if (0 == run || t1 - t0 < r->rows_ms) {
+	    r->rows_ms = t1 - t0;
+	}
+	if (0 == run || t2 - t1 < r->cols_ms) {
+	    r->cols_ms = t2 - t1;
+	}
+    }
+    free (img);
+    free (cols);
+    return 0;
+}
+
+// Print one line of results.
+static void
+print_result (const char* fname, const result_t* r)
+{
+    double rows_ns = r->rows_ms * 1000000.0 / (0 == r->lines ? 1 : r->lines);
+    double cols_ns = r->cols_ms * 1000000.0 / (0 == r->lines ? 1 : r->lines);
+
+    printf ("%s\t%u\t%u\t%.1f\t%.1f\t%.2f\n", fname, r->width, r->height,
+	    rows_ns, cols_ns, 0 < cols_ns ? rows_ns / cols_ns : 0.0);
+}
+
+int
+main (int argc, char* argv[])
+{
+    int      runs = DEFAULT_RUNS;
+    int      i;
+    int      opt;
+    int      status = 0;
+    result_t r;
+    result_t total;
+
+    // Check syntax of invocation.
+    while (-1 != (opt = getopt (argc, argv, "n:"))) {
+	switch (opt) {
+	    case 'n': runs = atoi (optarg); break;
+	    default: runs = 0; break;
+	}
+    }
+    if (optind >= argc || 0 >= runs) {
+	fprintf (stderr, "usage: %s [-n <runs>] <photo file>...\n", argv[0]);
+	return 2;
+    }
+
+    printf ("file\twidth\theight\trows_ns\tcols_ns\tspeedup\n");
+    memset (&total, 0, sizeof (total));
+    for (i = optind; argc > i; i++) {
+	if (0 != bench_photo (argv[i], runs, &r)) {
+	    status = 2;
+	    continue;
+	}
+	print_result (argv[i], &r);
+	total.lines += r.lines;
+	total.rows_ms += r.rows_ms;
+	total.cols_ms += r.cols_ms;
+    }
+    print_result ("TOTAL", &total);
+    return status;
+}
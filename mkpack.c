@@ -0,0 +1,319 @@
+/*									tab:8
+ *
+ * mkpack.c - bundle image files into an asset pack
+ *
+ * Filename:	    mkpack.c
+ * History:
+ *	1	First written.
+ */
+
+/* 
+ * This file is a standalone utility program that writes an asset pack
+ * (see pack.h) holding the files named on the command line.  Each file
+ * is recorded under its name exactly as given, which should match the
+ * name used by the game (for example, images/bardeen.photo).
+ *
+ *     mkpack [-r] <pack file> <image file> ...
+ *
+ * With -r, room photos (5:6:5 or compressed indexed) and object images
+ * are stored in the raw forms that the game uses in place (see pack.h).
+ * Room photos are quantized as they are packed; the quantizer can be
+ * chosen with ADVENTURE_QUANTIZER, as for the game.  Other files,
+ * including tiled photos, are copied as they are.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pack.h"
+#include "qphoto.h"
+#include "quantize.h"
+
+
+#define MAX_WIDTH  1024		/* largest image width accepted  */
+#define MAX_HEIGHT 1024		/* largest image height accepted */
+
+
+// Sort directory entries by name.
+static int
+compare_entries (const void* a, const void* b)
+{
+    return strcmp (((const pack_entry_t*)a)->name, 
+		   ((const pack_entry_t*)b)->name);
+}
+
+// Check whether a file name ends with a suffix.
+static int
+has_suffix (const char* name, const char* suffix)
+{
+    size_t len = strlen (name);
+
+    return (strlen (suffix) <= len && 
+	    0 == strcmp (name + len - strlen (suffix), suffix));
+}
+
+// Copy the rest of an open file into the pack at the current position.
+// Return 1 on success, 0 on failure.
+static int
+copy_file (FILE* out, FILE* in, pack_entry_t* e)
+{
+    uint8_t buf[PACK_ALIGN];
+    size_t  n;
+
+    while (0 < (n = fread (buf, 1, sizeof (buf), in))) {
+	if (n != fwrite (buf, 1, n, out)) {
+	    perror ("write pack file");
+	    return 0;
+	}
+	e->size += n;
+    }
+    return 1;
+}
+
+// Read the pixels of a room photo or object image file, of pixel_size 
+// bytes each, into dynamically allocated memory, top row first.  The 
+// header has already been read.  Return pointer to pixels on success,
+// or NULL on failure.
+static void*
+read_image_pixels (FILE* in, pack_entry_t* e, const photo_header_t* h,
+		   size_t pixel_size)
+{
+    uint8_t* pix;
+    uint32_t y;
+
+    if (MAX_WIDTH < h->width || MAX_HEIGHT < h->height) {
+	fprintf (stderr, "%s is too large.\n", e->name);
+	return NULL;
+    }
+    if (NULL == (pix = malloc (h->width * h->height * pixel_size))) {
+        perror ("allocate image");
+	return NULL;
+    }
+
+    // Rows are stored from bottom to top; read each into place.
+    for (y = h->height; 0 < y; y--) {
+	if (h->width != fread (pix + (y - 1) * h->width * pixel_size,
+			       pixel_size, h->width, in)) {
+	    fprintf (stderr, "%s is too short.\n", e->name);
+	    free (pix);
+	    return NULL;
+	}
+    }
+    return pix;
+}
+
+// Write a room photo, given either as 5:6:5 pixels or as a compressed
+// indexed photo, into the pack as a raw photo.  The photo header (or 
+// the magic sequence of a compressed photo) has already been read.
+// Return 1 on success, 0 on failure.
+static int
+write_raw_photo (FILE* out, FILE* in, pack_entry_t* e, photo_header_t* h)
+{
+    qphoto_header_t qh;
+    uint16_t*       pix = NULL;
+    uint8_t*        img;
+    int             ok;
+
+    memcpy (qh.magic, PACK_RAW_PHOTO, sizeof (qh.magic));
+    if (0 == memcmp (h, QPHOTO_MAGIC, sizeof (*h))) {
+	if (1 != fread (&qh.hdr, sizeof (qh.hdr), 1, in) ||
+	    1 != fread (qh.palette, sizeof (qh.palette), 1, in) ||
+	    MAX_WIDTH < qh.hdr.width || MAX_HEIGHT < qh.hdr.height ||
+	    NULL == (img = malloc (qh.hdr.width * qh.hdr.height))) {
+	    fprintf (stderr, "%s could not be read.\n", e->name);
+	    return 0;
+	}
+	if (0 != qphoto_read_rows (in, img, qh.hdr.width, qh.hdr.height)) {
+	    fprintf (stderr, "%s is corrupt.\n", e->name);
+	    free (img);
+	    return 0;
+	}
+    } else {
+	qh.hdr = *h;
+	if (NULL == (pix = read_image_pixels (in, e, h, sizeof (pix[0])))) {
+	    return 0;
+	}
+	if (NULL == (img = malloc (h->width * h->height)) ||
+	    0 != quantize (pix, h->width * h->height, qh.palette, img)) {
+	    perror ("quantize photo");
+	    free (pix);
+	    free (img);
+	    return 0;
+	}
+	free (pix);
+    }
+
+    ok = (1 == fwrite (&qh, sizeof (qh), 1, out) &&
+	  qh.hdr.height == fwrite (img, qh.hdr.width, qh.hdr.height, out));
+    if (!ok) {
+	perror ("write pack file");
+    }
+    e->size = sizeof (qh) + qh.hdr.width * qh.hdr.height;
+    free (img);
+    return ok;
+}
+
+// Write an object image into the pack as a raw object.  The header has
+// already been read.  Return 1 on success, 0 on failure.
+static int
+write_raw_object (FILE* out, FILE* in, pack_entry_t* e, photo_header_t* h)
+{
+    pack_object_header_t oh;
+    uint8_t*             img;
+    int                  ok;
+
+    if (NULL == (img = read_image_pixels (in, e, h, sizeof (img[0])))) {
+	return 0;
+    }
+    memcpy (oh.magic, PACK_RAW_OBJECT, sizeof (oh.magic));
+    oh.hdr = *h;
+    ok = (1 == fwrite (&oh, sizeof (oh), 1, out) &&
+	  h->height == fwrite (img, h->width, h->height, out));
+    if (!ok) {
+	perror ("write pack file");
+    }
+    e->size = sizeof (oh) + h->width * h->height;
+    free (img);
+    return ok;
+}
+
+// Write one file into the pack at the current position, in raw form if
+// raw is non-zero and the file is a room photo or object image, then 
+// pad the pack to the next PACK_ALIGN boundary.  Return 1 on success,
+// 0 on failure.
+static int
+pack_file (FILE* out, pack_entry_t* e, int raw)
+{
+    static const uint8_t zeros[PACK_ALIGN];
+    FILE*          in;
+    photo_header_t h;
+    uint32_t       pad;
+    int            ok;
+
+    if (NULL == (in = fopen (e->name, "rb"))) {
+        perror (e->name);
+	return 0;
+    }
+    e->size = 0;
+    if (raw && (1 != fread (&h, sizeof (h), 1, in) ||
+		0 == memcmp (&h, QPHOTO_TILED_MAGIC, sizeof (h)))) {
+	raw = 0;
+    }
+    if (raw && (has_suffix (e->name, ".photo") || 
+		0 == memcmp (&h, QPHOTO_MAGIC, sizeof (h)))) {
+	ok = write_raw_photo (out, in, e, &h);
+    } else if (raw && has_suffix (e->name, ".obj")) {
+	ok = write_raw_object (out, in, e, &h);
+    } else {
+	ok = (0 == fseek (in, 0, SEEK_SET) && copy_file (out, in, e));
+    }
+    (void)fclose (in);
+    if (!ok) {
+	return 0;
+    }
+
+    pad = (PACK_ALIGN - e->size % PACK_ALIGN) % PACK_ALIGN;
+    if (pad != fwrite (zeros, 1, pad, out)) {
+	perror ("write pack file");
+	return 0;
+    }
+    return 1;
+}
+
+int
+main (int argc, char* argv[])
+{
+    FILE*         out;
+    pack_header_t hdr;
+    pack_entry_t* dir;
+    uint32_t      n_entries;
+    uint32_t      idx;
+    uint32_t      offset;
+    int32_t       written;
+    const char*   quantizer;
+    int           raw = 0;
+    int           bad = 0;
+    int           opt;
+
+    // Check syntax of invocation.
+    while (-1 != (opt = getopt (argc, argv, "r"))) {
+	switch (opt) {
+	    case 'r': raw = 1; break;
+	    default: bad = 1; break;
+	}
+    }
+    if (bad || 2 > argc - optind) {
+    	fprintf (stderr, "usage: %s [-r] <pack file> <image file> ...\n",
+		 argv[0]);
+	return 2;
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (NULL != (quantizer = getenv ("ADVENTURE_QUANTIZER")) &&
+	0 != quantize_set_method (quantizer)) {
+	fprintf (stderr, "unknown ADVENTURE_QUANTIZER method %s\n", quantizer);
+	return 2;
+    }
+
+    // Build the directory, sorted by name.
+    n_entries = argc - 2;
+    if (NULL == (dir = calloc (n_entries, sizeof (dir[0])))) {
+        perror ("allocate directory");
+	return 2;
+    }
+    for (idx = 0; n_entries > idx; idx++) {
+	if (PACK_NAME_LEN <= strlen (argv[idx + 2])) {
+	    fprintf (stderr, "%s: name too long for pack\n", argv[idx + 2]);
+	    return 2;
+	}
+	strcpy (dir[idx].name, argv[idx + 2]);
+    }
+    qsort (dir, n_entries, sizeof (dir[0]), compare_entries);
+    for (idx = 1; n_entries > idx; idx++) {
+	if (0 == strcmp (dir[idx - 1].name, dir[idx].name)) {
+	    fprintf (stderr, "%s named twice\n", dir[idx].name);
+	    return 2;
+	}
+    }
+
+    if (NULL == (out = fopen (argv[1], "wb"))) {
+        perror ("open pack file");
+	return 2;
+    }
+
+    // Copy the files, starting at the first PACK_ALIGN boundary after
+    // the directory, which is filled in once the sizes are known.
+    offset = sizeof (hdr) + n_entries * sizeof (dir[0]);
+    offset = (offset + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+    written = (0 == fseek (out, offset, SEEK_SET));
+    for (idx = 0; written && n_entries > idx; idx++) {
+	dir[idx].offset = offset;
+	written = pack_file (out, &dir[idx], raw);
+	offset += (dir[idx].size + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+    }
+
+    // Write the header and directory.
+    memcpy (hdr.magic, PACK_MAGIC, sizeof (hdr.magic));
+    hdr.version = PACK_VERSION;
+    hdr.n_entries = n_entries;
+    hdr.align = PACK_ALIGN;
+    if (written && 
+	(0 != fseek (out, 0, SEEK_SET) ||
+	 1 != fwrite (&hdr, sizeof (hdr), 1, out) ||
+	 n_entries != fwrite (dir, sizeof (dir[0]), n_entries, out))) {
+	perror ("write pack directory");
+	written = 0;
+    }
+    if (EOF == fclose (out)) {
+	perror ("close pack file");
+        written = 0;
+    }
+    free (dir);
+
+    // Return value based on success of pack file write and close.
+    return (written ? 0 : 3);
+}
@@ -0,0 +1,146 @@
+/*									tab:8
+ *
+ * mkqphoto.c - convert room photos into compressed indexed photos
+ *
+ * Filename:	    mkqphoto.c
+ * History:
+ *	1	First written.
+ */
+
+/* 
+ * This file is a standalone utility program that quantizes a room photo
+ * (5:6:5 RGB, as written by mp2photo) and writes it as a compressed 
+ * indexed photo (see qphoto.h).  The game's read_photo accepts either 
+ * kind of file, so a room photo can simply be replaced by its compressed
+ * form, which is smaller and needs no quantization when loaded.
+ *
+ * The quantizer can be chosen with ADVENTURE_QUANTIZER, as for the game.
+ *
+ * With -t, the photo is written as a tiled photo instead, which the game
+ * reads a tile at a time as the photo is drawn.  Tiled photos may be far
+ * larger than other room photos, as for panoramas.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "photo_headers.h"
+#include "qphoto.h"
+#include "quantize.h"
+
+
+#define MAX_WIDTH  1024		/* largest photo width accepted  */
+#define MAX_HEIGHT 1024		/* largest photo height accepted */
+
+
+// Read a room photo into dynamically allocated memory, top row first.
+// Return pointer to pixels on success, or NULL on failure.
+static uint16_t*
+read_photo_pixels (const char* fname, FILE* in, photo_header_t* h,
+		   uint32_t max_width, uint32_t max_height)
+{
+    uint16_t* pix;
+    uint32_t  y;
+
+    if (1 != fread (h, sizeof (*h), 1, in) || 
+	max_width < h->width || max_height < h->height) {
+        fprintf (stderr, "%s does not appear to be a room photo.\n", fname);
+	return NULL;
+    }
+    if (NULL == (pix = malloc (h->width * h->height * sizeof (pix[0])))) {
+        perror ("allocate photo");
+	return NULL;
+    }
+
+    // Rows are stored from bottom to top; read each into place.
+    for (y = h->height; 0 < y; y--) {
+	if (h->width != fread (pix + (y - 1) * h->width, sizeof (pix[0]),
+			       h->width, in)) {
+	    fprintf (stderr, "%s is too short.\n", fname);
+	    free (pix);
+	    return NULL;
+	}
+    }
+    return pix;
+}
+
+int
+main (int argc, char* argv[])
+{
+    FILE*          in;
+    FILE*          out;
+    photo_header_t hdr;
+    uint16_t*      pix;
+    uint8_t        palette[QUANT_COLORS][3];
+    uint8_t*       img;
+    const char*    quantizer;
+    int32_t        written;
+    int            tiled = 0;
+    int            bad = 0;
+    int            opt;
+
+    // Check syntax of invocation.
+    while (-1 != (opt = getopt (argc, argv, "t"))) {
+	switch (opt) {
+	    case 't': tiled = 1; break;
+	    default: bad = 1; break;
+	}
+    }
+    if (bad || 2 != argc - optind) {
+    	fprintf (stderr, "usage: %s [-t] <photo file name> <output file>\n", 
+		 argv[0]);
+	return 2;
+    }
+    argv += optind - 1;
+    if (NULL != (quantizer = getenv ("ADVENTURE_QUANTIZER")) &&
+	0 != quantize_set_method (quantizer)) {
+	fprintf (stderr, "unknown ADVENTURE_QUANTIZER method %s\n", quantizer);
+	return 2;
+    }
+
+    // Read the photo, then quantize it.  The input file is closed before
+    // the output file is opened, so a photo can be converted in place.
+    if (NULL == (in = fopen (argv[1], "rb"))) {
+        perror ("open photo file");
+	return 2;
+    }
+    pix = (tiled ? 
+	   read_photo_pixels (argv[1], in, &hdr, QPHOTO_MAX_TILED_WIDTH,
+			      QPHOTO_MAX_TILED_HEIGHT) :
+	   read_photo_pixels (argv[1], in, &hdr, MAX_WIDTH, MAX_HEIGHT));
+    (void)fclose (in);
+    if (NULL == pix) {
+	return 2;
+    }
+    if (NULL == (img = malloc (hdr.width * hdr.height)) ||
+	0 != quantize (pix, hdr.width * hdr.height, palette, img)) {
+        perror ("quantize photo");
+	return 2;
+    }
+    free (pix);
+
+    // Try to write, then close, the output file.
+    if (NULL == (out = fopen (argv[2], "wb"))) {
+        perror ("open output file");
+	return 2;
+    }
+    written = (0 == (tiled ? qphoto_write_tiled (out, &hdr, palette, img) :
+		     qphoto_write (out, &hdr, palette, img)));
+    if (!written) {
+        perror ("write data to output file");
+    }
+    if (EOF == fclose (out)) {
+	perror ("close output file");
+        written = 0;
+    }
+
+    // Free the image data.
+    free (img);
+
+    // Return value based on success of output file write and close.
+    return (written ? 0 : 3);
+}
@@ -194,6 +194,19 @@ static unsigned short target_img;   /* offset of displayed screen image */
  */
 static void (*horiz_line_fn) (int, int, unsigned char[SCROLL_X_DIM]);
 static void (*vert_line_fn) (int, int, unsigned char[SCROLL_Y_DIM]);
+
+/* 
+ * optional function provided by the caller to set_rect_fill() and used
+ * by draw_rect to obtain a whole rectangle of pixels at once
+ */
+static void (*rect_fill_fn) (int, int, int, int, int, unsigned char*);
+
+/* 
+ * optional function provided by the caller to set_planar_fill() and 
+ * tried first by draw_rect to write a rectangle straight into the planes
+ * of the build buffer
+ */
+static int (*planar_fill_fn) (int, int, int, int, int, unsigned char*[4]);
 	
 
 /* 
@@ -293,6 +306,8 @@ set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
         return -1;
     horiz_line_fn = horiz_fill_fn;
     vert_line_fn = vert_fill_fn;
+    rect_fill_fn = NULL;
+    planar_fill_fn = NULL;
 
     /* Initialize the logical view window to position (0,0). */
     show_x = show_y = 0;
@@ -686,6 +701,70 @@ draw_vert_line (int x)
 }
 
 
+/*
+ * copy_to_planes
+ *   DESCRIPTION: Copy part of a row of pixels into the appropriate planes
+ *                of the build buffer.
+ *   INPUTS: (x,y) -- logical view coordinates of the first pixel
+ *           buf -- the pixels
+ *           n -- number of pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+static void
+copy_to_planes (int x, int y, const unsigned char* buf, int n)
+{
+    unsigned char* addr;  /* address of first pixel in build buffer */
+   			  /*     (without plane offset)              */
+    int p_off;            /* offset of plane of first pixel          */
+    int i;		  /* loop index over pixels                  */
+
+    /* Calculate starting address in build buffer. */
+    addr = img3 + (x >> 2) + y * SCROLL_X_WIDTH;
+
+    /* Calculate plane offset of first pixel. */
+    p_off = (3 - (x & 3));
+
+    /* Copy image data into appropriate planes in build buffer. */
+    for (i = 0; i < n; i++) {
+        addr[p_off * SCROLL_SIZE] = buf[i];
+	if (--p_off < 0) {
+	    p_off = 3;
+	    addr++;
+	}
+    }
+}
+
+
+/*
+ * copy_planar
+ *   DESCRIPTION: Try to have the caller's planar callback (see 
+ *                set_planar_fill) copy a rectangle straight into the 
+ *                planes of the build buffer.  Logical pixel x lies in 
+ *                build buffer plane 3 - (x & 3).
+ *   INPUTS: (x,y) -- logical view coordinates of upper left pixel
+ *           (w,h) -- width and height of rectangle
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the rectangle was copied, or -1 if it must be 
+ *                 drawn some other way
+ *   SIDE EFFECTS: may draw into the build buffer
+ */   
+static int
+copy_planar (int x, int y, int w, int h)
+{
+    unsigned char* planes[4]; /* first pixel of rectangle in each plane */
+    int i;		      /* loop index over planes                 */
+
+    if (planar_fill_fn == NULL)
+	return -1;
+    for (i = 0; i < 4; i++)
+	planes[i] = img3 + (3 - i) * SCROLL_SIZE + (x >> 2) + 
+		    y * SCROLL_X_WIDTH;
+    return (*planar_fill_fn) (x, y, w, h, SCROLL_X_WIDTH, planes);
+}
+
+
 /*
  * draw_horiz_line
  *   DESCRIPTION: Draw a horizontal map line into the build buffer.  The 
@@ -703,10 +782,6 @@ int
 draw_horiz_line (int y)
 {
     unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line */
-    unsigned char* addr;             /* address of first pixel in build    */
-   				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
-    int i;			     /* loop index over pixels             */
 
     /* Check whether requested line falls in the logical view window. */
     if (y < 0 || y >= SCROLL_Y_DIM)
@@ -715,28 +790,139 @@ draw_horiz_line (int y)
     /* Adjust y to the logical row value. */
     y += show_y;
 
+    /* Copy the line straight into the planes if the caller can. */
+    if (copy_planar (show_x, y, SCROLL_X_DIM, 1) == 0)
+	return 0;
+
     /* Get the image of the line. */
     (*horiz_line_fn) (show_x, y, buf);
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (show_x >> 2) + y * SCROLL_X_WIDTH;
+    /* Copy image data into appropriate planes in build buffer. */
+    copy_to_planes (show_x, y, buf, SCROLL_X_DIM);
 
-    /* Calculate plane offset of first pixel. */
-    p_off = (3 - (show_x & 3));
+    /* Return success. */
+    return 0;
+}
 
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_X_DIM; i++) {
-        addr[p_off * SCROLL_SIZE] = buf[i];
-	if (--p_off < 0) {
-	    p_off = 3;
-	    addr++;
+
+/*
+ * set_rect_fill
+ *   DESCRIPTION: Provide a callback used by draw_rect to obtain a
+ *                graphical image of a rectangle of the logical view in
+ *                one call.  Without one (the default after set_mode_X),
+ *                draw_rect draws the rectangle line by line with the
+ *                callbacks given to set_mode_X.
+ *   INPUTS: rect_fn -- called as rect_fn (x, y, w, h, stride, buf) to
+ *                      fill buf with w by h pixels of the logical view
+ *                      starting at (x,y), row by row, with rows stride
+ *                      bytes apart; may be NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces any previous rectangle callback
+ */   
+void
+set_rect_fill (void (*rect_fn) (int, int, int, int, int, unsigned char*))
+{
+    rect_fill_fn = rect_fn;
+}
+
+
+/*
+ * set_planar_fill
+ *   DESCRIPTION: Provide a callback tried first by draw_rect to write a
+ *                rectangle of the logical view straight into the four
+ *                planes of the build buffer, for callers that keep the
+ *                map split into planes already.
+ *   INPUTS: planar_fn -- called as planar_fn (x, y, w, h, stride, planes)
+ *                        to copy w by h pixels of the logical view 
+ *                        starting at (x,y); the pixel at (x + i, y + j)
+ *                        goes to planes[(x + i) & 3][stride * j + 
+ *                        ((x + i) >> 2) - (x >> 2)]; returns 0 on 
+ *                        success, or -1 (having written nothing) to have
+ *                        the rectangle drawn the usual way; may be NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces any previous planar callback
+ */   
+void
+set_planar_fill (int (*planar_fn) (int, int, int, int, int, 
+				   unsigned char*[4]))
+{
+    planar_fill_fn = planar_fn;
+}
+
+
+/* buffer that receives the pixels of a rectangle drawn by draw_rect */
+static unsigned char rect_buf[SCROLL_X_DIM * SCROLL_Y_DIM];
+
+
+/*
+ * draw_rect
+ *   DESCRIPTION: Draw a rectangle of the map into the build buffer, such
+ *                as the strip of lines exposed by moving the logical
+ *                view window, or the whole window.  The rectangle is
+ *                offset from the upper left of the logical view window
+ *                by the given numbers of pixels.  
+ *   INPUTS: (x,y) -- the 0-based pixel column and row of the upper left
+ *                    pixel of the rectangle within the logical view window
+ *           (w,h) -- width and height of the rectangle in pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If the rectangle does not lie
+ *                 within the logical view window, the function returns
+ *                 -1.
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+int
+draw_rect (int x, int y, int w, int h)
+{
+    unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line */
+    int i;			     /* loop index over rows or columns    */
+
+    /* Check whether requested rectangle falls in the logical view window. */
+    if (x < 0 || y < 0 || w < 0 || h < 0 || 
+	x + w > SCROLL_X_DIM || y + h > SCROLL_Y_DIM)
+	return -1;
+
+    /* 
+     * Adjust (x,y) to logical coordinates, and try to copy the rectangle
+     * straight into the planes.
+     */
+    x += show_x;
+    y += show_y;
+    if (copy_planar (x, y, w, h) == 0)
+	return 0;
+
+    /* 
+     * Without a rectangle callback, draw whole lines: columns for a strip
+     * as tall as the window, and otherwise rows, clipped to the rectangle.
+     */
+    if (rect_fill_fn == NULL) {
+	if (h == SCROLL_Y_DIM && w < SCROLL_X_DIM) {
+	    for (i = 0; i < w; i++)
+		(void)draw_vert_line (x - show_x + i);
+	    return 0;
 	}
+	for (i = 0; i < h; i++) {
+	    (*horiz_line_fn) (show_x, y + i, buf);
+	    copy_to_planes (x, y + i, buf + x - show_x, w);
+	}
+	return 0;
     }
 
+    /* Get the image of the rectangle. */
+    if (w == 0 || h == 0)
+	return 0;
+    (*rect_fill_fn) (x, y, w, h, w, rect_buf);
+
+    /* Copy image data into appropriate planes in build buffer. */
+    for (i = 0; i < h; i++)
+	copy_to_planes (x, y + i, rect_buf + w * i, w);
+
     /* Return success. */
     return 0;
 }
 
+
 #endif /* !defined(TEXT_RESTORE_PROGRAM) */
 
 
@@ -136,6 +136,30 @@ extern int draw_horiz_line (int y);
 /* draw a vertical line at horizontal pixel x within the logical view window */
 extern int draw_vert_line (int x);
 
+/* 
+ * set a callback that fills a buffer with a w by h rectangle of the map
+ * at (x,y), rows stride bytes apart, for draw_rect (NULL to draw lines)
+ */
+extern void set_rect_fill (void (*rect_fn) (int x, int y, int w, int h,
+					    int stride, unsigned char* buf));
+
+/* 
+ * set a callback that copies a w by h rectangle of the map at (x,y)
+ * straight into the four build buffer planes, rows stride bytes apart,
+ * where planes[k] gets the pixels with x coordinates equal to k modulo 4;
+ * it returns 0 on success, or -1 to have draw_rect fill the rectangle
+ * the usual way (NULL to always do so)
+ */
+extern void set_planar_fill (int (*planar_fn) (int x, int y, int w, int h,
+					       int stride,
+					       unsigned char* planes[4]));
+
+/* 
+ * draw a w by h rectangle with upper left pixel (x,y) within the logical
+ * view window
+ */
+extern int draw_rect (int x, int y, int w, int h);
+
 /* show status bar function takes the string for room, typed command and status message and puts the colors for each into a buffer to print to display*/
 extern void show_status_bar (const char *room, char* typed_cmd, const char* status_msg); //room name    
 
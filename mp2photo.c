@@ -45,14 +45,28 @@
  * The output file format is 5:6:5 RGB stored in the same order as in the
  * BMP, i.e., rows from bottom to top, and from right to left within each
  * row.  The header simply gives the dimensions of the image.
+ *
+ * Any number of files can be converted at once, either by giving pairs
+ * of BMP and output file names or by naming a directory of BMP files
+ * and a directory for the output (each "x.bmp" becomes "x.photo", or
+ * "x.obj" for object images):
+ *
+ *     mp2photo [-j <threads>] <BMP file> <output file> [<BMP> <out>]...
+ *     mp2photo [-j <threads>] -d <BMP directory> <output directory>
+ *
+ * Files are converted in parallel, by one thread per processor unless
+ * -j says otherwise.
  */
 
 
+#include <dirent.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "parallel.h"
 #include "photo_headers.h"
 
 
@@ -60,6 +74,21 @@
 #define WRITE_OBJECT_IMAGE 0		/* output defaults to room photo */
 #endif
 
+#if (1 == WRITE_OBJECT_IMAGE)
+typedef uint8_t out_pixel_t;		/* 2:2:2 RGB                     */
+#define OUTPUT_SUFFIX ".obj"
+#else
+typedef uint16_t out_pixel_t;		/* 5:6:5 RGB                     */
+#define OUTPUT_SUFFIX ".photo"
+#endif
+
+// One file to be converted.
+typedef struct {
+    char* bmp_name;
+    char* out_name;
+    int   status;			// exit status for this file
+} job_t;
+
 
 /* 
  * Calculate width of one row of a BMP image in bytes, including padding
@@ -128,13 +157,15 @@ read_bmp_image_data (FILE* in, const bmp_header_t* h)
 }
 
 // Write header and data as either 5:6:5 RGB words (little endian) or
-// 2:2:2 RGB bytes, row by row, to the output file.  Return 1 on success, 
-// 0 on failure.
+// 2:2:2 RGB bytes, row by row, to the output file.  Each row is built
+// in memory and written with one call.  Return 1 on success, 0 on
+// failure.
 static int
 write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img)
 {
     photo_header_t photo_header;
     uint32_t       row_width;
+    out_pixel_t    row[4096];	// widest BMP accepted
     uint16_t	   x;
     uint16_t	   y;
 
@@ -169,18 +200,21 @@ write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img)
 	    		((img[row_width * y + 3 * x + 1] >> 2) << 5) | 
 			(img[row_width * y + 3 * x] >> 3);
 #endif /* WRITE_OBJECT_IMAGE */
-	    if (1 != fwrite (&vga_color, sizeof (vga_color), 1, out)) {
-	        perror ("write data to output file");
-		return 0;
-	    }
+	    row[x] = vga_color;
+	}
+	if (h->img_width != fwrite (row, sizeof (row[0]), h->img_width, out)) {
+	    perror ("write data to output file");
+	    return 0;
 	}
     }
 
     return 1;
 }
 
-int
-main (int argc, char* argv[])
+// Convert one BMP file.  Return 0 on success, 2 if the BMP can't be
+// read or the output file can't be opened, or 3 if writing fails.
+static int
+convert_file (const char* bmp_name, const char* out_name)
 {
     FILE*        in;
     FILE*        out;
@@ -188,25 +222,19 @@ main (int argc, char* argv[])
     uint8_t*     img_data;
     int32_t      written;
 
-    // Check syntax of invocation.
-    if (3 != argc) {
-    	fprintf (stderr, "usage: %s <BMP file name> <output file>\n", argv[0]);
-	return 2;
-    }
-
     // Try to open the two files.
-    if (NULL == (in = fopen (argv[1], "r+b"))) {
-        perror ("open BMP file");
+    if (NULL == (in = fopen (bmp_name, "r+b"))) {
+        perror (bmp_name);
 	return 2;
     }
-    if (NULL == (out = fopen (argv[2], "w+b"))) {
+    if (NULL == (out = fopen (out_name, "w+b"))) {
 	fclose (in);
-        perror ("open output file");
+        perror (out_name);
 	return 2;
     }
 
     // Check validity of input file, then read image data from input file.
-    if (!bmp_header_check (argv[1], in, &bmp_header) ||
+    if (!bmp_header_check (bmp_name, in, &bmp_header) ||
 	NULL == (img_data = read_bmp_image_data (in, &bmp_header))) {
 	fclose (in);
 	fclose (out);
@@ -230,3 +258,139 @@ main (int argc, char* argv[])
     return (written ? 0 : 3);
 }
 
+// Convert the file for job number idx (called by parallel_for).
+static void
+convert_job (void* arg, int32_t idx)
+{
+    job_t* jobs = arg;
+
+    jobs[idx].status = convert_file (jobs[idx].bmp_name, jobs[idx].out_name);
+}
+
+// Join a directory name and a file name (with a new suffix, if suffix
+// is not NULL, replacing the name's last four characters).  Return a 
+// dynamically allocated string, or NULL on failure.
+static char*
+make_path (const char* dir, const char* name, const char* suffix)
+{
+    size_t len = strlen (name) - (NULL != suffix ? 4 : 0);
+    char*  path;
+
+    if (NULL == suffix) {
+	suffix = "";
+    }
+    if (NULL != (path = malloc (strlen (dir) + len + strlen (suffix) + 2))) {
+	sprintf (path, "%s/%.*s%s", dir, (int)len, name, suffix);
+    }
+    return path;
+}
+
+// Order jobs by BMP file name.
+static int
+compare_jobs (const void* a, const void* b)
+{
+    return strcmp (((const job_t*)a)->bmp_name, ((const job_t*)b)->bmp_name);
+}
+
+// Make a job for each BMP file in a directory, sorted by name.  Return
+// the number of jobs, or -1 on failure.
+static int32_t
+list_directory (const char* bmp_dir, const char* out_dir, job_t** jobs_p)
+{
+    DIR*           dir;
+    struct dirent* ent;
+    job_t*         jobs = NULL;
+    job_t*         grown;
+    int32_t        n_jobs = 0;
+    int32_t        max_jobs = 0;
+    size_t         len;
+
+    if (NULL == (dir = opendir (bmp_dir))) {
+	perror (bmp_dir);
+	return -1;
+    }
+    while (NULL != (ent = readdir (dir))) {
+	len = strlen (ent->d_name);
+	if (4 >= len || 0 != strcmp (ent->d_name + len - 4, ".bmp")) {
+	    continue;
+	}
+	if (n_jobs == max_jobs) {
+	    max_jobs = (0 == max_jobs ? 64 : 2 * max_jobs);
+	    if (NULL == (grown = realloc (jobs, max_jobs * sizeof (jobs[0])))) {
+		break;
+	    }
+	    jobs = grown;
+	}
+	if (NULL == (jobs[n_jobs].bmp_name = 
+		     make_path (bmp_dir, ent->d_name, NULL)) ||
+	    NULL == (jobs[n_jobs].out_name = 
+		     make_path (out_dir, ent->d_name, OUTPUT_SUFFIX))) {
+	    break;
+	}
+	n_jobs++;
+    }
+    (void)closedir (dir);
+    if (NULL != ent) {
+        perror ("list BMP files");
+	return -1;
+    }
+    qsort (jobs, n_jobs, sizeof (jobs[0]), compare_jobs);
+    *jobs_p = jobs;
+    return n_jobs;
+}
+
+int
+main (int argc, char* argv[])
+{
+    job_t*  jobs;
+    int32_t n_jobs;
+    int32_t n_threads = 0;
+    int     by_dir = 0;
+    int     status = 0;
+    int     opt;
+    int32_t i;
+
+    // Check syntax of invocation.
+    while (-1 != (opt = getopt (argc, argv, "dj:"))) {
+	switch (opt) {
+	    case 'd': by_dir = 1; break;
+	    case 'j': n_threads = atoi (optarg); break;
+	    default: n_threads = -1; break;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+    if (0 > n_threads || 0 == argc || 0 != argc % 2 || (by_dir && 2 != argc)) {
+    	fprintf (stderr, "usage: %s [-j <threads>] <BMP file name> "
+		 "<output file> [<BMP> <output>]...\n"
+		 "       %s [-j <threads>] -d <BMP directory> "
+		 "<output directory>\n", argv[-optind], argv[-optind]);
+	return 2;
+    }
+
+    // Make the list of files to convert.
+    if (by_dir) {
+	if (0 > (n_jobs = list_directory (argv[0], argv[1], &jobs))) {
+	    return 2;
+	}
+    } else {
+	n_jobs = argc / 2;
+	if (NULL == (jobs = malloc (n_jobs * sizeof (jobs[0])))) {
+	    perror ("allocate file list");
+	    return 2;
+	}
+	for (i = 0; n_jobs > i; i++) {
+	    jobs[i].bmp_name = argv[2 * i];
+	    jobs[i].out_name = argv[2 * i + 1];
+	}
+    }
+
+    // Convert them all, then report the worst failure.
+    parallel_for (n_jobs, n_threads, convert_job, jobs);
+    for (i = 0; n_jobs > i; i++) {
+	if (status < jobs[i].status) {
+	    status = jobs[i].status;
+	}
+    }
+    return status;
+}
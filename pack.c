@@ -0,0 +1,179 @@
+/*									tab:8
+ *
+ * pack.c - asset pack holding many image files in one
+ *
+ * Filename:	    pack.c
+ * History:
+ *	1	First written.
+ */
+
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pack.h"
+
+
+/* file-scope variables */
+
+/* 
+ * The mapped asset pack, or NULL if none.  These are set only by 
+ * pack_open and pack_close, and are read-only while images are loaded.
+ */
+static const uint8_t*      pack_base = NULL;  /* start of mapped pack */
+static size_t              pack_size = 0;     /* size of mapped pack  */
+static const pack_entry_t* pack_dir = NULL;   /* pack directory       */
+static uint32_t            pack_n_entries = 0; /* directory entries   */
+
+
+/*
+ * pack_open
+ *   DESCRIPTION: Map an asset pack into memory and check its header and
+ *                directory.
+ *   INPUTS: fname -- name of the pack file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: replaces any pack already open
+ */
+int32_t
+pack_open (const char* fname)
+{
+    int                  fd;	/* pack file descriptor     */
+    struct stat          st;	/* pack file status         */
+    void*                base;	/* start of mapped pack     */
+    const pack_header_t* h;	/* pack header              */
+    const pack_entry_t*  e;	/* directory entry          */
+    uint32_t             idx;	/* index over entries       */
+
+    pack_close ();
+    if (-1 == (fd = open (fname, O_RDONLY))) {
+	return -1;
+    }
+    if (0 != fstat (fd, &st) || sizeof (*h) > (size_t)st.st_size ||
+	MAP_FAILED == (base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED,
+				    fd, 0))) {
+	(void)close (fd);
+	return -1;
+    }
+    (void)close (fd);
+
+    /* 
+     * Check the header, then make sure that the directory and all file
+     * contents lie within the pack and that names are terminated.
+     */
+    h = base;
+    if (0 != memcmp (h->magic, PACK_MAGIC, sizeof (h->magic)) ||
+	PACK_VERSION != h->version || PACK_ALIGN != h->align ||
+	(st.st_size - sizeof (*h)) / sizeof (*e) < h->n_entries) {
+	(void)munmap (base, st.st_size);
+	return -1;
+    }
+    e = (const pack_entry_t*)(h + 1);
+    for (idx = 0; h->n_entries > idx; idx++) {
+	if ('\0' != e[idx].name[PACK_NAME_LEN - 1] ||
+	    st.st_size < e[idx].offset ||
+	    st.st_size - e[idx].offset < e[idx].size ||
+	    (0 < idx && 0 <= strcmp (e[idx - 1].name, e[idx].name))) {
+	    (void)munmap (base, st.st_size);
+	    return -1;
+	}
+    }
+
+    pack_base = base;
+    pack_size = st.st_size;
+    pack_dir = e;
+    pack_n_entries = h->n_entries;
+    return 0;
+}
+
+
+/*
+ * pack_close
+ *   DESCRIPTION: Unmap the asset pack, if any.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: data found with pack_find become invalid
+ */
+void
+pack_close ()
+{
+    if (NULL != pack_base) {
+	(void)munmap ((void*)pack_base, pack_size);
+	pack_base = NULL;
+	pack_size = 0;
+	pack_dir = NULL;
+	pack_n_entries = 0;
+    }
+}
+
+
+/*
+ * compare_entry
+ *   DESCRIPTION: Compare a file name with a directory entry's name; used
+ *                with bsearch.
+ *   INPUTS: key -- the file name (const char*)
+ *           elt -- the entry (const pack_entry_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as for strcmp
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_entry (const void* key, const void* elt)
+{
+    return strcmp (key, ((const pack_entry_t*)elt)->name);
+}
+
+
+/*
+ * pack_find
+ *   DESCRIPTION: Look up a file in the asset pack.
+ *   INPUTS: fname -- the file name
+ *   OUTPUTS: *size -- size of the file's contents
+ *   RETURN VALUE: pointer to the file's contents, or NULL if the file is
+ *                 not in the pack (or no pack is open)
+ *   SIDE EFFECTS: none
+ */
+const void*
+pack_find (const char* fname, uint32_t* size)
+{
+    const pack_entry_t* e;	/* directory entry found */
+
+    if (NULL == pack_base ||
+	NULL == (e = bsearch (fname, pack_dir, pack_n_entries, sizeof (*e),
+			      compare_entry))) {
+	return NULL;
+    }
+    *size = e->size;
+    return pack_base + e->offset;
+}
+
+
+/*
+ * pack_fopen
+ *   DESCRIPTION: Open a file for reading, from the asset pack if the file
+ *                is packed, or from the file system if not.
+ *   INPUTS: fname -- the file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the open stream, or NULL on failure
+ *   SIDE EFFECTS: none
+ */
+FILE*
+pack_fopen (const char* fname)
+{
+    const void* data;	/* packed file contents */
+    uint32_t    size;	/* size of contents     */
+
+    if (NULL != (data = pack_find (fname, &size))) {
+	/* An empty file can't be opened in memory, but is short anyway. */
+	if (0 == size) {
+	    return NULL;
+	}
+	return fmemopen ((void*)data, size, "rb");
+    }
+    return fopen (fname, "rb");
+}
@@ -0,0 +1,102 @@
+/*									tab:8
+ *
+ * pack.h - asset pack holding many image files in one, header file
+ *
+ * Filename:	    pack.h
+ * History:
+ *	1	First written.
+ */
+#ifndef PACK_H
+#define PACK_H
+
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "photo_headers.h"
+#include "qphoto.h"
+
+
+/*
+ * An asset pack bundles the room photos and object images into a single
+ * file so that they can all be reached with one open.  The file starts 
+ * with a pack_header_t, followed by a directory of n_entries
+ * pack_entry_t, sorted by name.  Each entry names one file (as it would
+ * be passed to fopen) and gives the position and size of its contents,
+ * which start on a PACK_ALIGN boundary so that each can be mapped on
+ * its own.  Packs are made by the mkpack tool.
+ */
+#define PACK_MAGIC    "MP2K"	/* asset pack magic sequence           */
+#define PACK_VERSION  1		/* bump when layout changes            */
+#define PACK_ALIGN    4096	/* alignment of file contents in pack  */
+#define PACK_NAME_LEN 56	/* longest name (with terminating NUL) */
+
+/* default asset pack; empty to use only separate files */
+#if !defined(ASSET_PACK)
+#define ASSET_PACK "images.pack"
+#endif
+
+typedef struct pack_header_t pack_header_t;
+struct pack_header_t {
+    char     magic[4];		/* PACK_MAGIC (not terminated) */
+    uint32_t version;		/* PACK_VERSION                */
+    uint32_t n_entries;		/* number of directory entries */
+    uint32_t align;		/* PACK_ALIGN                  */
+};
+
+typedef struct pack_entry_t pack_entry_t;
+struct pack_entry_t {
+    char     name[PACK_NAME_LEN]; /* file name, NUL-terminated     */
+    uint32_t offset;		  /* position of contents in pack */
+    uint32_t size;		  /* size of contents in bytes    */
+};
+
+/*
+ * With -r, mkpack stores room photos and object images in raw forms 
+ * that the game uses in place: a photo or image read from the pack
+ * points straight at its pixels in the mapped pack, so the pixels are
+ * never copied to the heap, and every game process on a machine shares
+ * the one copy in the page cache.  Both forms store pixels uncompressed,
+ * top row first, right after a header:
+ *
+ *   raw photo:  a qphoto_header_t (see qphoto.h) with PACK_RAW_PHOTO
+ *               as its magic sequence, then one VGA color per pixel
+ *   raw object: a pack_object_header_t, then one 2:2:2 color per pixel
+ *
+ * Room photos are quantized when the pack is made, so the quantizer
+ * chosen at run time does not apply to them.  Raw forms are only ever
+ * found in packs.
+ */
+#define PACK_RAW_PHOTO  "QPR1"	/* raw photo magic sequence  */
+#define PACK_RAW_OBJECT "QOB1"	/* raw object magic sequence */
+
+typedef struct pack_object_header_t pack_object_header_t;
+struct pack_object_header_t {
+    char           magic[4];	/* PACK_RAW_OBJECT (not terminated) */
+    photo_header_t hdr;		/* image dimensions                 */
+};
+
+/* 
+ * Map an asset pack for use by pack_fopen.  Returns 0 on success, or -1
+ * if the pack can't be opened or is not valid (in which case files are
+ * used on their own).
+ */
+extern int32_t pack_open (const char* fname);
+
+/* Unmap the asset pack, if any. */
+extern void pack_close (void);
+
+/* 
+ * Find a file's contents in the asset pack.  Returns a pointer to the
+ * contents and sets *size, or returns NULL if the file is not packed.
+ */
+extern const void* pack_find (const char* fname, uint32_t* size);
+
+/*
+ * Open a file for reading in binary mode, taking its contents from the 
+ * asset pack if it is packed, and from the file system otherwise.
+ * Returns NULL on failure.
+ */
+extern FILE* pack_fopen (const char* fname);
+
+#endif /* PACK_H */
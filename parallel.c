@@ -0,0 +1,126 @@
+/*									tab:8
+ *
+ * parallel.c - simple parallel loop over independent jobs
+ *
+ * Filename:	    parallel.c
+ * History:
+ *	1	First written.
+ */
+
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+
+#define MAX_PARALLEL_THREADS 64	/* upper bound on threads per loop */
+
+
+/* state shared by the threads working on one parallel loop */
+typedef struct parallel_loop_t parallel_loop_t;
+struct parallel_loop_t {
+    pthread_mutex_t lock;	/* protects next                  */
+    int32_t         next;	/* index of next job to be started */
+    int32_t         n_jobs;	/* total number of jobs           */
+    parallel_fn_t   fn;		/* job function                   */
+    void*           arg;	/* argument to job function       */
+};
+
+
+/*
+ * parallel_threads
+ *   DESCRIPTION: Turn a requested thread count into an actual count.
+ *   INPUTS: n_threads -- requested count, or 0 for one per processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of threads to use (at least 1, and no more
+ *                 than MAX_PARALLEL_THREADS)
+ *   SIDE EFFECTS: none
+ */
+int32_t
+parallel_threads (int32_t n_threads)
+{
+    if (0 >= n_threads) {
+	n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    }
+    if (1 > n_threads) {
+	return 1;
+    }
+    if (MAX_PARALLEL_THREADS < n_threads) {
+	return MAX_PARALLEL_THREADS;
+    }
+    return n_threads;
+}
+
+
+/*
+ * parallel_worker
+ *   DESCRIPTION: Start jobs of a parallel loop one at a time until none
+ *                remain.
+ *   INPUTS: arg -- the loop (a parallel_loop_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: runs jobs
+ */
+static void*
+parallel_worker (void* arg)
+{
+    parallel_loop_t* loop = arg; /* loop being worked on */
+    int32_t          idx;	 /* job to run next      */
+
+    while (1) {
+	(void)pthread_mutex_lock (&loop->lock);
+	idx = loop->next++;
+	(void)pthread_mutex_unlock (&loop->lock);
+	if (loop->n_jobs <= idx) {
+	    return NULL;
+	}
+	loop->fn (loop->arg, idx);
+    }
+}
+
+
+/*
+ * parallel_for
+ *   DESCRIPTION: Run n_jobs independent jobs on a group of threads.
+ *   INPUTS: n_jobs -- number of jobs
+ *           n_threads -- number of threads (0 for one per processor)
+ *           fn -- job function
+ *           arg -- argument passed to each call of fn
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: creates and joins threads; runs jobs
+ */
+void
+parallel_for (int32_t n_jobs, int32_t n_threads, parallel_fn_t fn, void* arg)
+{
+    parallel_loop_t loop;	/* shared loop state                 */
+    pthread_t       tid[MAX_PARALLEL_THREADS]; /* helper threads     */
+    int32_t         n_helpers;	/* number of helper threads created  */
+
+    loop.next = 0;
+    loop.n_jobs = n_jobs;
+    loop.fn = fn;
+    loop.arg = arg;
+    (void)pthread_mutex_init (&loop.lock, NULL);
+
+    /* 
+     * The calling thread works too, so create one helper fewer than the 
+     * thread count (and none beyond the number of jobs).
+     */
+    n_threads = parallel_threads (n_threads);
+    if (n_jobs < n_threads) {
+	n_threads = n_jobs;
+    }
+    for (n_helpers = 0; n_threads - 1 > n_helpers; n_helpers++) {
+	if (0 != pthread_create (&tid[n_helpers], NULL, parallel_worker,
+				 &loop)) {
+	    break;
+	}
+    }
+    (void)parallel_worker (&loop);
+    while (0 < n_helpers) {
+	(void)pthread_join (tid[--n_helpers], NULL);
+    }
+    (void)pthread_mutex_destroy (&loop.lock);
+}
@@ -0,0 +1,36 @@
+/*									tab:8
+ *
+ * parallel.h - simple parallel loop over independent jobs, header file
+ *
+ * Filename:	    parallel.h
+ * History:
+ *	1	First written.
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+
+#include <stdint.h>
+
+
+/* a job: do piece number idx of the work described by arg */
+typedef void (*parallel_fn_t) (void* arg, int32_t idx);
+
+/*
+ * Get the number of threads to use for a requested count: the count
+ * itself if positive, or the number of online processors if zero.
+ */
+extern int32_t parallel_threads (int32_t n_threads);
+
+/*
+ * Call fn (arg, idx) for each idx from 0 to n_jobs - 1, using up to
+ * n_threads threads (0 for one per processor), the caller included.
+ * Jobs are started in index order but may finish in any order; fn must
+ * be safe to call from several threads at once.  Returns once all jobs
+ * are done.  Falls back to fewer threads (down to the caller alone) if
+ * threads cannot be created.
+ */
+extern void parallel_for (int32_t n_jobs, int32_t n_threads, 
+			  parallel_fn_t fn, void* arg);
+
+#endif /* PARALLEL_H */
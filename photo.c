@@ -36,17 +36,83 @@
  */
 
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "assert.h"
 #include "modex.h"
+#include "pack.h"
 #include "photo.h"
+#include "photo_cache.h"
 #include "photo_headers.h"
+#include "photo_store.h"
+#include "photo_tiles.h"
+#include "qphoto.h"
+#include "quantize.h"
+#include "simd.h"
 #include "world.h"
 
 
+/*
+ * Object pixels are drawn over the room with SSE2 or AVX2 when the
+ * processor supports them (checked at run time; see simd.h), falling
+ * back to plain C otherwise.  Compile with -DPHOTO_USE_SIMD=0 to always
+ * use the plain C version.
+ */
+#if !defined(PHOTO_USE_SIMD)
+#define PHOTO_USE_SIMD 1
+#endif
+
+
 /* types local to this file (declared in types.h) */
 
+/*
+ * Room photos and object images are shared.  Reading a file that has 
+ * already been read, or whose contents match those of a photo or image
+ * already read, returns the existing structure with its reference count
+ * raised.  Freeing a photo or image just drops a reference until the
+ * last one goes away.
+ */
+typedef struct shared_t shared_t;
+struct shared_t {
+    char*     fname;	/* name of file read (a copy)            */
+    uint64_t  hash;	/* photo_hash of the contents in memory  */
+    uint32_t  refs;	/* number of references                  */
+    shared_t* next;	/* next in list of shared items          */
+    void*     item;	/* the photo_t or image_t containing this */
+};
+
+/* function used to check whether two shared items have equal contents */
+typedef int32_t (*same_fn_t) (const void* a, const void* b);
+
+/* function used to draw a run of object pixels (see blit) */
+typedef void (*blit_fn_t) (uint8_t* dst, const uint8_t* src, int32_t n);
+
+/* 
+ * Rows and columns of object images with at most this many runs of
+ * opaque pixels are drawn by copying the runs; those with more are
+ * drawn by the blit, which checks every pixel between the first and
+ * last runs faster than that many short copies can be made.
+ */
+#define SPAN_COPY_MAX 4
+
+/*
+ * A pending refinement of a photo first shown with 2:2:2 pixels (see
+ * photo_start_refine).  The refined photo is built separately and only
+ * copied into the photo once complete.
+ */
+typedef struct refine_t refine_t;
+struct refine_t {
+    photo_t*       p;		/* photo to refine (NULL if freed)     */
+    const char*    fname;	/* photo file name (not copied)        */
+    photo_header_t hdr;		/* photo dimensions                    */
+    uint16_t*      pix;		/* 5:6:5 pixels, top row first         */
+    photo_t*       fine;	/* refined photo, or NULL until done   */
+    refine_t*      next;	/* next in queue of refinements        */
+};
+
 /* 
  * A room photo.  Note that you must write the code that selects the
  * optimized palette colors and fills in the pixel data using them as 
@@ -54,11 +120,28 @@
  * Pixel data are stored as one-byte values starting from the upper
  * left and traversing the top row before returning to the left of
  * the second row, and so forth.  No padding should be used.
+ *
+ * A tiled photo (see qphoto.h) has no pixel data in memory; its pixels
+ * are read through tiles instead (see photo_tiles.h).
  */
 struct photo_t {
     photo_header_t hdr;			/* defines height and width */
     uint8_t        palette[192][3];     /* optimized palette colors */
-    uint8_t*       img;                 /* pixel data               */
+    uint8_t*       img;                 /* pixel data (NULL if tiled) */
+    photo_tiles_t* tiles;		/* tiles (NULL if not tiled)  */
+    refine_t*      refine;		/* pending refinement, or NULL */
+    shared_t       share;		/* sharing information      */
+};
+
+/*
+ * A run of opaque pixels in one row or column of an object image, so
+ * that drawing the image need not look at its transparent pixels (see
+ * make_spans).
+ */
+typedef struct obj_span_t obj_span_t;
+struct obj_span_t {
+    uint8_t start;	/* first pixel of run       */
+    uint8_t len;	/* number of pixels in run  */
 };
 
 /* 
@@ -73,6 +156,17 @@ struct photo_t {
 struct image_t {
     photo_header_t hdr;			/* defines height and width */
     uint8_t*       img;                 /* pixel data               */
+    uint16_t*      row_span;		/* index in span of first run */
+					/*   of each row, then of the */
+					/*   end of the last row (or  */
+					/*   NULL if there are no runs) */
+    uint16_t*      col_span;		/* same for columns         */
+    obj_span_t*    span;		/* opaque runs, row by row, */
+					/*   then column by column  */
+    uint8_t*       cols;		/* pixel data column by     */
+					/*   column (NULL if there  */
+					/*   are no runs)           */
+    shared_t       share;		/* sharing information      */
 };
 
 
@@ -86,573 +180,2286 @@ struct image_t {
  */
 static const room_t* cur_room = NULL; 
 
-
 /* 
- * fill_horiz_buffer
- *   DESCRIPTION: Given the (x,y) map pixel coordinate of the leftmost 
- *                pixel of a line to be drawn on the screen, this routine 
- *                produces an image of the line.  Each pixel on the line
- *                is represented as a single byte in the image.
+ * Lists of all photos and images in memory, for sharing.  The lists and
+ * the sharing information in each photo and image are protected by 
+ * share_lock, since photos and images may be read by several threads.
+ */
+static pthread_mutex_t share_lock = PTHREAD_MUTEX_INITIALIZER;
+static shared_t*       shared_photos = NULL;
+static shared_t*       shared_images = NULL;
+
+/*
+ * Object images are read once and kept until the program ends, so each
+ * image (structure and pixels in one piece) is carved out of a shared
+ * arena of page-aligned slabs rather than allocated on its own.  The
+ * arena is protected by image_lock.  Room photos, which may be evicted
+ * one at a time (see photo_store.h), are instead each allocated as a
+ * single block.  In both cases pixel data start on a cache line.
+ */
+#define PIXEL_ALIGN      ARENA_LINE
+#define PIXEL_OFFSET(t)  ((sizeof (t) + PIXEL_ALIGN - 1) & ~(PIXEL_ALIGN - 1))
+#define IMAGE_SLAB_SIZE  (256 * 1024)
+
+static pthread_mutex_t image_lock = PTHREAD_MUTEX_INITIALIZER;
+static arena_t         image_arena = ARENA_INIT (IMAGE_SLAB_SIZE);
+
+/*
+ * Progressive loading (see photo_start_refine).  The queue of pending
+ * refinements, the refine field of every photo, and the photo shown on
+ * the screen are protected by refine_lock.  The refinement thread waits
+ * on refine_cv for work or to be stopped.  When both locks are needed,
+ * refine_lock is taken before share_lock.
+ */
+static pthread_mutex_t refine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  refine_cv = PTHREAD_COND_INITIALIZER;
+static pthread_t       refine_tid;	   /* refinement thread id         */
+static int32_t         refine_running = 0; /* 1 if thread started          */
+static refine_t*       refine_queue = NULL; /* refinements not yet begun   */
+static refine_t*       refining = NULL;	   /* refinement under way         */
+static photo_t*        shown = NULL;	   /* photo whose palette is set   */
+
+/*
+ * The current room composited into one layer: its photo with all of
+ * its objects drawn on top, so that filling a line of the screen is a
+ * plain copy.  The layer covers the photo and any objects hanging off
+ * its right or bottom edges; pixels outside the photo are color 0.  It
+ * is built for the photo layer_photo of room layer_room, and patched
+ * when objects in the room change (see room_objects_moved).  A NULL
+ * layer_photo means the layer must be rebuilt before use.  The layer
+ * is reserved from the room photo budget (see photo_store_reserve), so
+ * it is built only when it fits.  Tiled photos, and photos whose layer
+ * doesn't fit or can't be allocated, are drawn line by line instead; in
+ * the latter case layer is NULL, and layer_room and layer_photo record
+ * the room so that the layer is not tried again until it next must be
+ * rebuilt.
  *
- *                Note that this routine draws both the room photo and
- *                the objects in the room.
+ * With COLUMN_LAYER, the layer is also kept in column-major order in
+ * layer_cols, so that vertical lines are read from consecutive bytes
+ * rather than one row apart.
  *
- *   INPUTS: (x,y) -- leftmost pixel of line to be drawn 
- *   OUTPUTS: buf -- buffer holding image data for the line
+ * With PLANAR_LAYER, the layer is also kept split into the four mode X
+ * planes in layer_planes, so that it can be copied straight into the
+ * planes of the build buffer (see fill_planar_buffer).  Plane k holds
+ * the pixels whose x coordinate is k modulo 4, row by row, each row
+ * layer_width / 4 bytes long; the layer width is then a multiple of 4.
+ */
+static uint8_t*       layer = NULL;	   /* composited pixels            */
+static uint8_t*       layer_cols = NULL;   /* same, column by column       */
+static uint8_t*       layer_planes = NULL; /* same, plane by plane         */
+static uint32_t       layer_space = 0;	   /* pixels allocated for layer   */
+static int32_t        layer_width = 0;	   /* layer width in pixels        */
+static int32_t        layer_height = 0;	   /* layer height in pixels       */
+static const room_t*  layer_room = NULL;   /* room composited in layer     */
+static const photo_t* layer_photo = NULL;  /* photo composited in layer    */
+
+
+/* 
+ * blit
+ *   DESCRIPTION: Draw a run of object image pixels over a line, skipping
+ *                transparent pixels.
+ *   INPUTS: src -- object image pixels
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- line pixels, replaced by those of src that are not
+ *                   OBJ_CLR_TRANSP
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-void
-fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
+static void
+blit (uint8_t* dst, const uint8_t* src, int32_t n)
 {
-    int            idx;   /* loop index over pixels in the line          */ 
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgx;  /* loop index over pixels in object image      */ 
-    int            yoff;  /* y offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
-    int32_t        obj_x; /* object x position                           */
-    int32_t        obj_y; /* object y position                           */
-    const image_t* img;   /* object image                                */
-
-    /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
-
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_X_DIM; idx++) {
-        buf[idx] = (0 <= x + idx && view->hdr.width > x + idx ?
-		    view->img[view->hdr.width * y + x + idx] : 0);
-    }
-
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
-	obj_x = obj_get_x (obj);
-	obj_y = obj_get_y (obj);
-	img = obj_image (obj);
-
-        /* Is object outside of the line we're drawing? */
-	if (y < obj_y || y >= obj_y + img->hdr.height ||
-	    x + SCROLL_X_DIM <= obj_x || x >= obj_x + img->hdr.width) {
-	    continue;
-	}
-
-	/* The y offset of drawing is fixed. */
-	yoff = (y - obj_y) * img->hdr.width;
-
-	/* 
-	 * The x offsets depend on whether the object starts to the left
-	 * or to the right of the starting point for the line being drawn.
-	 */
-	if (x <= obj_x) {
-	    idx = obj_x - x;
-	    imgx = 0;
-	} else {
-	    idx = 0;
-	    imgx = x - obj_x;
-	}
+    int32_t idx;	/* index over pixels */
 
-	/* Copy the object's pixel data. */
-	for (; SCROLL_X_DIM > idx && img->hdr.width > imgx; idx++, imgx++) {
-	    pixel = img->img[yoff + imgx];
-
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
-	    }
+    for (idx = 0; n > idx; idx++) {
+	/* Don't copy transparent pixels. */
+	if (OBJ_CLR_TRANSP != src[idx]) {
+	    dst[idx] = src[idx];
 	}
     }
 }
 
 
+#if PHOTO_USE_SIMD && HAVE_X86_SIMD
 /* 
- * fill_vert_buffer
- *   DESCRIPTION: Given the (x,y) map pixel coordinate of the top pixel of 
- *                a vertical line to be drawn on the screen, this routine 
- *                produces an image of the line.  Each pixel on the line
- *                is represented as a single byte in the image.
- *
- *                Note that this routine draws both the room photo and
- *                the objects in the room.
- *
- *   INPUTS: (x,y) -- top pixel of line to be drawn 
- *   OUTPUTS: buf -- buffer holding image data for the line
+ * blit_sse2
+ *   DESCRIPTION: Draw a run of object image pixels over a line, sixteen
+ *                pixels at a time with SSE2.  Each group is compared
+ *                against OBJ_CLR_TRANSP and merged into the line through
+ *                the resulting mask, with no branches.  Otherwise the
+ *                same as blit.
+ *   INPUTS: src -- object image pixels
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- line pixels, replaced by those of src that are not
+ *                   OBJ_CLR_TRANSP
  *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-void
-fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
+__attribute__ ((target ("sse2")))
+static void
+blit_sse2 (uint8_t* dst, const uint8_t* src, int32_t n)
 {
-    int            idx;   /* loop index over pixels in the line          */ 
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgy;  /* loop index over pixels in object image      */ 
-    int            xoff;  /* x offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
-    int32_t        obj_x; /* object x position                           */
-    int32_t        obj_y; /* object y position                           */
-    const image_t* img;   /* object image                                */
-
-    /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
-
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
-        buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
-		    view->img[view->hdr.width * (y + idx) + x] : 0);
-    }
-
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
-	obj_x = obj_get_x (obj);
-	obj_y = obj_get_y (obj);
-	img = obj_image (obj);
-
-        /* Is object outside of the line we're drawing? */
-	if (x < obj_x || x >= obj_x + img->hdr.width ||
-	    y + SCROLL_Y_DIM <= obj_y || y >= obj_y + img->hdr.height) {
-	    continue;
-	}
-
-	/* The x offset of drawing is fixed. */
-	xoff = x - obj_x;
-
-	/* 
-	 * The y offsets depend on whether the object starts below or 
-	 * above the starting point for the line being drawn.
-	 */
-	if (y <= obj_y) {
-	    idx = obj_y - y;
-	    imgy = 0;
-	} else {
-	    idx = 0;
-	    imgy = y - obj_y;
-	}
-
-	/* Copy the object's pixel data. */
-	for (; SCROLL_Y_DIM > idx && img->hdr.height > imgy; idx++, imgy++) {
-	    pixel = img->img[xoff + img->hdr.width * imgy];
-
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
-	    }
-	}
+    const __m128i transp = _mm_set1_epi8 (OBJ_CLR_TRANSP);
+    __m128i s, d, keep;	/* object pixels, line pixels, transparent mask */
+    int32_t idx;	/* index over pixels                            */
+
+    for (idx = 0; n >= idx + 16; idx += 16) {
+	s = _mm_loadu_si128 ((const __m128i*)(src + idx));
+	d = _mm_loadu_si128 ((const __m128i*)(dst + idx));
+	keep = _mm_cmpeq_epi8 (s, transp);
+	d = _mm_or_si128 (_mm_and_si128 (keep, d), _mm_andnot_si128 (keep, s));
+	_mm_storeu_si128 ((__m128i*)(dst + idx), d);
     }
+    blit (dst + idx, src + idx, n - idx);
 }
 
 
 /* 
- * image_height
- *   DESCRIPTION: Get height of object image in pixels.
- *   INPUTS: im -- object image pointer
- *   OUTPUTS: none
- *   RETURN VALUE: height of object image im in pixels
+ * blit_avx2
+ *   DESCRIPTION: Draw a run of object image pixels over a line, 32
+ *                pixels at a time with AVX2, merging with a byte blend.
+ *                Otherwise the same as blit_sse2.
+ *   INPUTS: src -- object image pixels
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- line pixels, replaced by those of src that are not
+ *                   OBJ_CLR_TRANSP
+ *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-uint32_t 
-image_height (const image_t* im)
+__attribute__ ((target ("avx2")))
+static void
+blit_avx2 (uint8_t* dst, const uint8_t* src, int32_t n)
 {
-    return im->hdr.height;
+    const __m256i transp = _mm256_set1_epi8 (OBJ_CLR_TRANSP);
+    __m256i s, d;	/* object pixels, line pixels */
+    int32_t idx;	/* index over pixels          */
+
+    for (idx = 0; n >= idx + 32; idx += 32) {
+	s = _mm256_loadu_si256 ((const __m256i*)(src + idx));
+	d = _mm256_loadu_si256 ((const __m256i*)(dst + idx));
+	d = _mm256_blendv_epi8 (s, d, _mm256_cmpeq_epi8 (s, transp));
+	_mm256_storeu_si256 ((__m256i*)(dst + idx), d);
+    }
+    blit_sse2 (dst + idx, src + idx, n - idx);
 }
+#endif /* PHOTO_USE_SIMD && HAVE_X86_SIMD */
 
 
 /* 
- * image_width
- *   DESCRIPTION: Get width of object image in pixels.
- *   INPUTS: im -- object image pointer
+ * pick_blit
+ *   DESCRIPTION: Choose the widest version of blit that the processor
+ *                supports.
+ *   INPUTS: none
  *   OUTPUTS: none
- *   RETURN VALUE: width of object image im in pixels
+ *   RETURN VALUE: the blit function
  *   SIDE EFFECTS: none
  */
-uint32_t 
-image_width (const image_t* im)
+static blit_fn_t
+pick_blit ()
 {
-    return im->hdr.width;
+#if PHOTO_USE_SIMD && HAVE_X86_SIMD
+    if (SIMD_HAS_AVX2 ()) {
+	return blit_avx2;
+    } 
+    if (SIMD_HAS_SSE2 ()) {
+	return blit_sse2;
+    }
+#endif
+    return blit;
 }
 
+
 /* 
- * photo_height
- *   DESCRIPTION: Get height of room photo in pixels.
- *   INPUTS: p -- room photo pointer
- *   OUTPUTS: none
- *   RETURN VALUE: height of room photo p in pixels
+ * draw_runs
+ *   DESCRIPTION: Draw part of one row or column of an object image over
+ *                a line, skipping transparent pixels.  Only the runs of
+ *                opaque pixels (see make_spans) that overlap the part
+ *                drawn are looked at: if there are no more than
+ *                SPAN_COPY_MAX, each is copied; otherwise the pixels
+ *                from the first to the last are drawn by the blit
+ *                function given.
+ *   INPUTS: src -- pixels of the row or column, in order
+ *           (sp,end) -- runs of the row or column, from sp up to but
+ *                       not including end
+ *           (a0,a1) -- pixels to draw, from a0 up to but not
+ *                      including a1
+ *           draw -- blit function (see pick_blit)
+ *   OUTPUTS: dst -- line pixels, starting with the one under pixel a0
+ *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-uint32_t 
-photo_height (const photo_t* p)
+static void
+draw_runs (uint8_t* dst, const uint8_t* src, const obj_span_t* sp,
+	   const obj_span_t* end, int32_t a0, int32_t a1, blit_fn_t draw)
 {
-    return p->hdr.height;
+    int32_t lo;	/* first pixel of run drawn          */
+    int32_t hi;	/* pixel after last one of run drawn */
+
+    while (end > sp && a0 >= sp->start + sp->len) {
+	sp++;
+    }
+    while (end > sp && a1 <= end[-1].start) {
+	end--;
+    }
+    if (end <= sp) {
+	return;
+    }
+    if (SPAN_COPY_MAX < end - sp) {
+	lo = (a0 > sp->start ? a0 : sp->start);
+	hi = (a1 < end[-1].start + end[-1].len ? a1 : 
+	      end[-1].start + end[-1].len);
+	(*draw) (dst + lo - a0, src + lo, hi - lo);
+	return;
+    }
+    for (; end > sp; sp++) {
+	lo = (a0 > sp->start ? a0 : sp->start);
+	hi = (a1 < sp->start + sp->len ? a1 : sp->start + sp->len);
+	for (; hi > lo; lo++) {
+	    dst[lo - a0] = src[lo];
+	}
+    }
 }
 
 
 /* 
- * photo_width
- *   DESCRIPTION: Get width of room photo in pixels.
- *   INPUTS: p -- room photo pointer
- *   OUTPUTS: none
- *   RETURN VALUE: width of room photo p in pixels
+ * draw_row
+ *   DESCRIPTION: Draw part of one row of an object image over a line,
+ *                skipping transparent pixels (see draw_runs).  An image
+ *                without runs is drawn entirely by the blit function.
+ *   INPUTS: img -- the object image
+ *           row -- the row of the image
+ *           (x0,x1) -- columns of the image to draw, from x0 up to but
+ *                      not including x1
+ *           draw -- blit function (see pick_blit)
+ *   OUTPUTS: dst -- line pixels, starting with the one under column x0
+ *   RETURN VALUE: none
  *   SIDE EFFECTS: none
  */
-uint32_t 
-photo_width (const photo_t* p)
+static void
+draw_row (uint8_t* dst, const image_t* img, int32_t row, int32_t x0, 
+	  int32_t x1, blit_fn_t draw)
 {
-    return p->hdr.width;
+    const uint8_t* src = img->img + img->hdr.width * row; /* row pixels */
+
+    if (NULL == img->row_span) {
+	(*draw) (dst, src + x0, x1 - x0);
+	return;
+    }
+    draw_runs (dst, src, img->span + img->row_span[row], 
+	       img->span + img->row_span[row + 1], x0, x1, draw);
 }
 
 
 /* 
- * prep_room
- *   DESCRIPTION: Prepare a new room for display.  You might want to set
- *                up the VGA palette registers according to the color
- *                palette that you chose for this room.
- *   INPUTS: r -- pointer to the new room
- *   OUTPUTS: none
+ * draw_column
+ *   DESCRIPTION: Draw part of one column of an object image over a
+ *                vertical line, skipping transparent pixels.  The column
+ *                is read from the image's column-major copy, so that it
+ *                is drawn exactly as a row is (see draw_runs).  An image
+ *                without runs, which has no such copy, is checked pixel
+ *                by pixel.
+ *   INPUTS: img -- the object image
+ *           col -- the column of the image
+ *           (y0,y1) -- rows of the image to draw, from y0 up to but
+ *                      not including y1
+ *           draw -- blit function (see pick_blit)
+ *   OUTPUTS: dst -- line pixels, starting with the one under row y0
  *   RETURN VALUE: none
- *   SIDE EFFECTS: changes recorded cur_room for this file
+ *   SIDE EFFECTS: none
  */
-void
-prep_room (const room_t* r)
+static void
+draw_column (uint8_t* dst, const image_t* img, int32_t col, int32_t y0,
+	     int32_t y1, blit_fn_t draw)
 {
-    /* Record the current room. */
-    cur_room = r;													//my code
-	photo_t* temp = room_photo(cur_room);
-	set_palette(temp->palette);
+    const uint8_t* src;		/* column pixels     */
+    int32_t        w;		/* distance to next  */
+    int32_t        y;		/* index over rows   */
+
+    if (NULL == img->cols) {
+	src = img->img + col;
+	w = img->hdr.width;
+	for (y = y0; y1 > y; y++) {
+	    if (OBJ_CLR_TRANSP != src[w * y]) {
+		dst[y - y0] = src[w * y];
+	    }
+	}
+	return;
+    }
+    draw_runs (dst, img->cols + img->hdr.height * col, 
+	       img->span + img->col_span[col], 
+	       img->span + img->col_span[col + 1], y0, y1, draw);
 }
 
 
 /* 
- * read_obj_image
- *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
- *                photo file and create an image structure from it.
- *   INPUTS: fname -- file name for input
+ * composite
+ *   DESCRIPTION: Composite a rectangle of the layer from the current
+ *                room's photo and objects.  Objects are drawn in the
+ *                order of the room's contents, skipping transparent
+ *                pixels.  The rectangle must lie within the layer.
+ *   INPUTS: view -- the current room's photo
+ *           (x0,y0) -- upper left corner of rectangle
+ *           (x1,y1) -- just beyond lower right corner of rectangle
  *   OUTPUTS: none
- *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
- *                 on failure
- *   SIDE EFFECTS: dynamically allocates memory for the image
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the layer
  */
-image_t*
-read_obj_image (const char* fname)
+static void
+composite (const photo_t* view, int32_t x0, int32_t y0, int32_t x1, 
+	   int32_t y1)
 {
-    FILE*    in;		/* input file               */
-    image_t* img = NULL;	/* image structure          */
-    uint16_t x;			/* index over image columns */
-    uint16_t y;			/* index over image rows    */
-    uint8_t  pixel;		/* one pixel from the file  */
-
-    /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the image pixels.
-     * If anything fails, clean up as necessary and return NULL.
-     */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (img = malloc (sizeof (*img))) ||
-	NULL != (img->img = NULL) || /* false clause for initialization */
-	1 != fread (&img->hdr, sizeof (img->hdr), 1, in) ||
-	MAX_OBJECT_WIDTH < img->hdr.width ||
-	MAX_OBJECT_HEIGHT < img->hdr.height ||
-	NULL == (img->img = malloc 
-		 (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
-	if (NULL != img) {
-	    if (NULL != img->img) {
-	        free (img->img);
-	    }
-	    free (img);
+    object_t*      obj;   /* loop index over objects in the room */
+    const image_t* img;   /* object image                        */
+    const uint8_t* src;   /* pixels copied or drawn              */
+    uint8_t*       dst;   /* layer pixels written                */
+    int32_t        y;     /* loop index over rows                */
+    int32_t        idx;   /* loop index over pixels in a row     */
+    int32_t        n;     /* pixels copied from the photo        */
+    int32_t        ox0, oy0, ox1, oy1; /* object clipped to rectangle */
+    blit_fn_t      draw = pick_blit (); /* draws object pixels    */
+#if PLANAR_LAYER
+    int32_t        k;     /* loop index over planes              */
+#endif
+
+    /* Copy the photo, leaving black any pixels beyond its edges. */
+    for (y = y0; y1 > y; y++) {
+	dst = layer + layer_width * y;
+	n = 0;
+	if (view->hdr.height > y && view->hdr.width > x0) {
+	    n = (view->hdr.width < x1 ? view->hdr.width : x1) - x0;
+	    (void)memcpy (dst + x0, view->img + view->hdr.width * y + x0, n);
 	}
-	if (NULL != in) {
-	    (void)fclose (in);
+	(void)memset (dst + x0 + n, 0, x1 - x0 - n);
+    }
+
+    /* Draw the objects that overlap the rectangle. */
+    for (obj = room_contents_iterate (layer_room); NULL != obj;
+	 obj = obj_next (obj)) {
+	img = obj_image (obj);
+	ox0 = obj_get_x (obj);
+	oy0 = obj_get_y (obj);
+	ox1 = ox0 + img->hdr.width;
+	oy1 = oy0 + img->hdr.height;
+	ox0 = (x0 > ox0 ? x0 : ox0);
+	oy0 = (y0 > oy0 ? y0 : oy0);
+	ox1 = (x1 < ox1 ? x1 : ox1);
+	oy1 = (y1 < oy1 ? y1 : oy1);
+	for (y = oy0; oy1 > y; y++) {
+	    draw_row (layer + layer_width * y + ox0, img, y - obj_get_y (obj),
+		      ox0 - obj_get_x (obj), ox1 - obj_get_x (obj), draw);
 	}
-	return NULL;
     }
 
-    /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
-     */
-    for (y = img->hdr.height; y-- > 0; ) {
-
-	/* Loop over columns from left to right. */
-	for (x = 0; img->hdr.width > x; x++) {
-
-	    /* 
-	     * Try to read one 8-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (img->img);
-		free (img);
-	        (void)fclose (in);
-		return NULL;
+#if COLUMN_LAYER
+    /* Copy the rectangle into the column-major layer. */
+    for (y = y0; y1 > y; y++) {
+	src = layer + layer_width * y;
+	for (idx = x0; x1 > idx; idx++) {
+	    layer_cols[layer_height * idx + y] = src[idx];
+	}
+    }
+#endif
+
+#if PLANAR_LAYER
+    /* Copy the rectangle into the planes of the planar layer. */
+    for (y = y0; y1 > y; y++) {
+	src = layer + layer_width * y;
+	for (k = 0; 4 > k; k++) {
+	    dst = layer_planes + (layer_width >> 2) * (layer_height * k + y);
+	    for (idx = x0 + ((k - x0) & 3); x1 > idx; idx += 4) {
+		dst[idx >> 2] = src[idx];
 	    }
-
-	    /* Store the pixel in the image data. */
-	    img->img[img->hdr.width * y + x] = pixel;
 	}
     }
-
-    /* All done.  Return success. */
-    (void)fclose (in);
-    return img;
+#endif
 }
 
-typedef struct {				// octree struct stores octree node data
-	int red;
-	int green;
-	int blue;
-	int counter;
-	int index;
-} octree_arr_t;
 
 /* 
- * read_photo
- *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
- *                photo file and create a photo structure from it.
- *                Code provided simply maps to 2:2:2 RGB.  You must
- *                replace this code with palette color selection, and
- *                must map the image pixels into the palette colors that
- *                you have defined.
- *   INPUTS: fname -- file name for input
+ * get_layer
+ *   DESCRIPTION: Get the composited layer of the current room, building
+ *                it first if necessary.
+ *   INPUTS: view -- the current room's photo
  *   OUTPUTS: none
- *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
- *                 on failure
- *   SIDE EFFECTS: dynamically allocates memory for the photo
+ *   RETURN VALUE: the layer's pixels, or NULL if the room must be drawn
+ *                 line by line
+ *   SIDE EFFECTS: may allocate memory for the layer, reserving it from
+ *                 the photo budget, and build it; may free the layer
+ *                 and other photos
  */
-
-photo_t* 
-read_photo (const char* fname)
+static const uint8_t*
+get_layer (const photo_t* view)
 {
-    FILE*    in;	/* input file               */
-    photo_t* p = NULL;	/* photo structure          */
-    uint16_t x;		/* index over image columns */
-    uint16_t y;		/* index over image rows    */
-    uint16_t pixel;	/* one pixel from the file  */
+    object_t* obj;	/* loop index over objects in the room */
+    int32_t   w;	/* layer width                         */
+    int32_t   h;	/* layer height                        */
+    uint8_t*  grown;	/* layer reallocated                   */
 
-    /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the photo pixels.
-     * If anything fails, clean up as necessary and return NULL.
-     */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (p = malloc (sizeof (*p))) ||
-	NULL != (p->img = NULL) || /* false clause for initialization */
-	1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
-	MAX_PHOTO_WIDTH < p->hdr.width ||
-	MAX_PHOTO_HEIGHT < p->hdr.height ||
-	NULL == (p->img = malloc 
-		 (p->hdr.width * p->hdr.height * sizeof (p->img[0])))) {
-	if (NULL != p) {
-	    if (NULL != p->img) {
-	        free (p->img);
-	    }
-	    free (p);
-	}
-	if (NULL != in) {
-	    (void)fclose (in);
-	}
+    if (layer_room == cur_room && layer_photo == view) {
+	return layer;
+    }
+    layer_photo = NULL;
+    if (NULL == view->img) {
 	return NULL;
     }
 
-/*INSERT CODE HERE*/
-/*OCTREE CODE*/
-
-octree_arr_t *level_two;
-octree_arr_t *level_four;
-int i, j;
-level_four = (octree_arr_t *)malloc(4096*sizeof(octree_arr_t));		// allocate space for level two and level four array
-level_two = (octree_arr_t *)malloc(64*sizeof(octree_arr_t));
-
-for(i=0; i < 64; i++){
-	level_two[i].red = 0;					// set each of the fields in octree_arr_t to 0
-	level_two[i].green = 0;
-	level_two[i].blue = 0;
-	level_two[i].counter = 0;
-	level_two[i].index = 0;
-}
-
-for(j=0; j < 4096; j++){
-	level_four[j].red = 0;
-	level_four[j].green = 0;
-	level_four[j].blue = 0;
-	level_four[j].counter = 0;
-	level_four[j].index = 0;
-
-}
-	
-/*END OF MY CODE*/
-
-    /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
-     */
-    for (y = p->hdr.height; y-- > 0; ) {
-
-	/* Loop over columns from left to right. */
-	for (x = 0; p->hdr.width > x; x++) {
-
-	    /* 
-	     * Try to read one 16-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (p->img);
-		free (p);
-	        (void)fclose (in);
-		return NULL;
-
-	    }
-	    /* 
-	     * 16-bit pixel is coded as 5:6:5 RGB (5 bits red, 6 bits green,
-	     * and 6 bits blue).  We change to 2:2:2, which we've set for the
-	     * game objects.  You need to use the other 192 palette colors
-	     * to specialize the appearance of each photo.
-	     *
-	     * In this code, you need to calculate the p->palette values,
-	     * which encode 6-bit RGB as arrays of three uint8_t's.  When
-	     * the game puts up a photo, you should then change the palette 
-	     * to match the colors needed for that photo.
-	     */
-	    // p->img[p->hdr.width * y + x] = (((pixel >> 14) << 4) |
-		// 			    (((pixel >> 9) & 0x3) << 2) |
-		// 			    ((pixel >> 3) & 0x3));
-
-	// 	/*MY CODE*/
-		// Here we turn pixel which holds 5:6:5 RGB values to 6:6:6 RGB values
- 		int red, green, blue;
- 		int two_index, four_index;
-		red = 0;
-		green = 0;
-		blue = 0;
-		red = ((pixel >> 11)) & 0x1F;			// bit shift pixel right 11 to get red bits and left 1 to make space for 0,
-		green = (pixel>>5) & 0x3F;				// bit shift green over 5 to get 5 green bits in least significant 6 bits
-		blue = (pixel) & 0x1F;					// bit shift blue to the left 1 to make space for 0 in the least significant bit
-
-		two_index = 0;
-		four_index= 0;
-		two_index = ((red>>3)<<4) | ((green>>4)<<2) | (blue>>3);  	// two_index grabs the most significant 2 red bits, 2 green bits, and 2 blue bits and puts it in an array
-		four_index = ((red>>1)<<8) | ((green>>2)<<4) | (blue>>1);	// four_index grabs the most significant 4 red bits, 4 green bits, and 4 blue bits and putting it in an array
-
-		//2 bit 
-		//Load the values for red, green, blue, index into the memory allocated array of 64
-		level_two[two_index].red += red;				// initialize index variables to 0
-		level_two[two_index].green += green;				
-		level_two[two_index].blue += blue;
-		level_two[two_index].index = two_index;
-		level_two[two_index].counter += 1;				// increment counter by 1 to keep track of how many times we load colors into mem
- 
-		//4 
-		//Load the values for red, green, blue, index into the memory allocated array of 4096
-		level_four[four_index].red += red;
-		level_four[four_index].green += green;
-		level_four[four_index].blue += blue;
-		level_four[four_index].index = four_index;
-		level_four[four_index].counter += 1;			// increment counter by 1 to keep track of how many times we load colors into mem
-	}
-    }
-
-	/*QUICKSORT FUNC*/
-	qsort(level_four, 4096, sizeof(octree_arr_t), compare);			// sorts the level four array, 4096 is the amount of elements to sort, size of each element, and the compare functions tells us the sorting order.
-	fseek(in, sizeof(p->hdr), SEEK_SET);							// moves the file position indicator within the file represented by in. The indicator is moved sizeof(p->hdr) bytes from the beginning of the file. sets the position in the file to a specific location, allowing you to read or write data from that point onward in the file.
-
-//redundancy check
-int flag;
-flag = 0;
-int red, green, blue;
-int two_index, four_index;
-for (y = p->hdr.height; y-- > 0; ) {
-
-	/* Loop over columns from left to right. */
-	for (x = 0; p->hdr.width > x; x++) {
-		flag =  0;
-		if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (p->img);
-		free (p);
-	        (void)fclose (in);
-		return NULL;
-		}
-
-		red = 0;
-		green = 0;
-		blue = 0;
-		red = ((pixel >> 11)) & 0x3F;			//6 bit values
-		green = (pixel>>5) & 0x3F;
-		blue = (pixel) & 0x1F;
-
-		two_index = 0;
-		four_index= 0;
-		two_index = ((red>>3)<<4) | ((green>>4)<<2) | (blue>>3);
-		four_index = ((red>>1)<<8) | ((green>>2)<<4) | (blue>>1);
-
-		p->img[p->hdr.width * y + x] = two_index +192;			// level two offset index is 192
-
-		for(i = 0; i<128; i++){									// check if the counter field of the octree_arr_t structure is non-zero
-			if(level_four[i].index == four_index){
-				level_two[two_index].red -= red;
-				level_two[two_index].green -= green;
-				level_two[two_index].blue -= blue;
-				level_two[two_index].counter -= 1;				// increment counter by 1
-				p->img[p->hdr.width*y+x] = i + 64;				// 64 is the size of level 2 allocated arr space
-				flag = 1;
-				break;
-			}
-		}
-		if(flag == 0){
-			p->img[p->hdr.width*y+x] = two_index+192;			// level two offset index is 192
-		}
-	}
-	}
-
-	for(i=0; i<128; i++){			// fill palette
-		if (level_four[i].counter) {
-		p->palette[i][0] = (level_four[i].red/level_four[i].counter)<<1;
-		p->palette[i][1] = (level_four[i].green/level_four[i].counter);
-		p->palette[i][2] = (level_four[i].blue/level_four[i].counter)<<1;
-		}
+    /* Make the layer large enough to hold the photo and all objects. */
+    w = view->hdr.width;
+    h = view->hdr.height;
+    for (obj = room_contents_iterate (cur_room); NULL != obj;
+	 obj = obj_next (obj)) {
+	if (w < obj_get_x (obj) + obj_image (obj)->hdr.width) {
+	    w = obj_get_x (obj) + obj_image (obj)->hdr.width;
 	}
-
-	//int i;
-	for(i=0; i<64; i++){			// fill palette
-	if (level_two[i].counter) {
-		p->palette[i+128][0] = (level_two[i].red/level_two[i].counter)<<1;
-		p->palette[i+128][1] = (level_two[i].green/level_two[i].counter);
-		p->palette[i+128][2] = (level_two[i].blue/level_two[i].counter)<<1;
+	if (h < obj_get_y (obj) + obj_image (obj)->hdr.height) {
+	    h = obj_get_y (obj) + obj_image (obj)->hdr.height;
 	}
+    }
+#if PLANAR_LAYER
+    w = (w + 3) & ~3;
+#endif
+    if (layer_space < w * h) {
+	if (0 != photo_store_reserve ((1 + COLUMN_LAYER + PLANAR_LAYER) *
+				      w * h) ||
+	    NULL == (grown = realloc (layer, (1 + COLUMN_LAYER + PLANAR_LAYER) *
+				      w * h))) {
+	    /* Give up the layer rather than keep it outside the budget. */
+	    free (layer);
+	    layer = NULL;
+	    layer_space = 0;
+	    (void)photo_store_reserve (0);
+	    layer_room = cur_room;
+	    layer_photo = view;
+	    return NULL;
 	}
-
-	free(level_two);			//free structs so program can use memory
-	free(level_four);
-	
-
-    /* All done.  Return success. */
-    (void)fclose (in);
-    return p;
-
+	layer = grown;
+	layer_space = w * h;
+    }
+    layer_cols = layer + layer_space;
+    layer_planes = layer + (1 + COLUMN_LAYER) * layer_space;
+    layer_width = w;
+    layer_height = h;
+    layer_room = cur_room;
+    layer_photo = view;
+    composite (view, 0, 0, w, h);
+    return layer;
 }
 
 
 /* 
- * COMPARE FUNCTION
- *   DESCRIPTION: compares two elements and returns a negative value if the first element should be placed before the second element, a positive value if the second element should be placed before the first element, and zero if they are equal in terms of sorting order.
- *   INPUTS: const void *a, const void *b (pointers to the elements being compared)
- *   OUTPUTS: None
- *   RETURN VALUE: 1, 0, -1
- *   SIDE EFFECTS: qsort function completed
+ * room_objects_moved
+ *   DESCRIPTION: Patch the composited layer of the current room after
+ *                objects have been added to or removed from a rectangle
+ *                of its photo.  Changes to other rooms are ignored,
+ *                since the layer is rebuilt when the room changes.
+ *   INPUTS: r -- the room changed
+ *           (x,y) -- upper left corner of rectangle
+ *           (w,h) -- width and height of rectangle
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may patch the layer or mark it for rebuilding
  */
-	int compare(const void  *a, const void *b){
+void
+room_objects_moved (const room_t* r, int32_t x, int32_t y, int32_t w,
+		    int32_t h)
+{
+    if (layer_room != r || NULL == layer_photo || NULL == layer) {
+	return;
+    }
 
-		if (((octree_arr_t*)a)->counter > ((octree_arr_t*)b)->counter) {
-			return -1 ;		
-		}
-		if (((octree_arr_t*)a)->counter == ((octree_arr_t*)b)->counter) {
-			return 0 ;		
-		}
-		if (((octree_arr_t*)a)->counter < ((octree_arr_t*)b)->counter) {
-			return 1 ;		
-		}
-	}
+    /* An object beyond the layer's edges needs a larger layer. */
+    if (layer_width < x + w || layer_height < y + h) {
+	layer_photo = NULL;
+	return;
+    }
+    composite (layer_photo, x, y, x + w, y + h);
+}
 
 
+/* 
+ * room_photo_swapped
+ *   DESCRIPTION: Note that a room's photo has been replaced, so that the
+ *                composited layer must be rebuilt if it is that room's.
+ *   INPUTS: r -- the room changed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may mark the layer for rebuilding
+ */
+void
+room_photo_swapped (const room_t* r)
+{
+    if (layer_room == r) {
+	layer_photo = NULL;
+    }
+}
 
 
+/* 
+ * copy_layer_row
+ *   DESCRIPTION: Copy part of a row of the current room's composited 
+ *                layer, which must be up to date (see get_layer).  
+ *                Pixels beyond the edges of the layer are black.
+ *   INPUTS: (x,y) -- leftmost pixel to copy
+ *           n -- number of pixels to copy
+ *   OUTPUTS: buf -- the pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+copy_layer_row (int x, int y, int n, uint8_t* buf)
+{
+    int lo;	/* first pixel of line within layer           */
+    int hi;	/* pixel beyond last one of line within layer */
+
+    lo = (0 > x ? -x : 0);
+    hi = layer_width - x;
+    if (0 > y || layer_height <= y || n <= lo || 0 >= hi) {
+	lo = hi = 0;
+    } else if (n < hi) {
+	hi = n;
+    }
+    (void)memset (buf, 0, lo);
+    (void)memcpy (buf + lo, layer + layer_width * y + x + lo, hi - lo);
+    (void)memset (buf + hi, 0, n - hi);
+}
+
+
+#if COLUMN_LAYER
+/* 
+ * copy_layer_column
+ *   DESCRIPTION: Copy part of a column of the current room's composited
+ *                layer from its column-major copy, as copy_layer_row
+ *                does for a row.
+ *   INPUTS: (x,y) -- topmost pixel to copy
+ *           n -- number of pixels to copy
+ *           stride -- distance in buffer from one pixel to the next
+ *   OUTPUTS: buf -- the pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+copy_layer_column (int x, int y, int n, uint8_t* buf, int stride)
+{
+    const uint8_t* src;	/* column of layer                               */
+    int            lo;	/* first pixel of column within layer            */
+    int            hi;	/* pixel beyond last one of column within layer  */
+    int            idx;	/* loop index over pixels in the column          */
+
+    lo = (0 > y ? -y : 0);
+    hi = layer_height - y;
+    if (0 > x || layer_width <= x || n <= lo || 0 >= hi) {
+	lo = hi = 0;
+    } else if (n < hi) {
+	hi = n;
+    }
+    src = layer_cols + layer_height * x + y;
+    for (idx = 0; lo > idx; idx++) {
+	buf[stride * idx] = 0;
+    }
+    for (; hi > idx; idx++) {
+	buf[stride * idx] = src[idx];
+    }
+    for (; n > idx; idx++) {
+	buf[stride * idx] = 0;
+    }
+}
+#endif /* COLUMN_LAYER */
+
+
+/*
+ * draw_object_rect
+ *   DESCRIPTION: Draw the part of an object that lies within a rectangle
+ *                of the room photo into a buffer holding that rectangle
+ *                or a larger one, skipping transparent pixels.
+ *   INPUTS: obj -- the object
+ *           (x0,y0) -- upper left pixel of rectangle to draw
+ *           (x1,y1) -- just beyond lower right pixel of rectangle to draw
+ *           (x,y) -- pixel held by the first byte of the buffer
+ *           stride -- distance in buffer from one row to the next
+ *           draw -- blit function (see pick_blit)
+ *   OUTPUTS: buf -- the object's pixels drawn over those in the buffer
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+draw_object_rect (const object_t* obj, int32_t x0, int32_t y0, int32_t x1,
+		  int32_t y1, int x, int y, int stride, uint8_t* buf, 
+		  blit_fn_t draw)
+{
+    const image_t* img = obj_image (obj);	/* object image        */
+    int32_t        obj_x = obj_get_x (obj);	/* object x position   */
+    int32_t        obj_y = obj_get_y (obj);	/* object y position   */
+    int32_t        row;	/* loop index over rows of object drawn */
+
+    /* Clip the object to the rectangle. */
+    x0 = (obj_x > x0 ? obj_x : x0);
+    y0 = (obj_y > y0 ? obj_y : y0);
+    x1 = (obj_x + img->hdr.width < x1 ? obj_x + img->hdr.width : x1);
+    y1 = (obj_y + img->hdr.height < y1 ? obj_y + img->hdr.height : y1);
+    if (x0 >= x1) {
+	return;
+    }
+    for (row = y0; y1 > row; row++) {
+	draw_row (buf + stride * (row - y) + x0 - x, img, row - obj_y,
+		  x0 - obj_x, x1 - obj_x, draw);
+    }
+}
+
+
+/*
+ * draw_object_column
+ *   DESCRIPTION: Draw the part of an object that lies on a vertical line
+ *                of the room photo into a buffer holding that line,
+ *                skipping transparent pixels.
+ *   INPUTS: obj -- the object
+ *           (x,y) -- top pixel of line
+ *           draw -- blit function (see pick_blit)
+ *   OUTPUTS: buf -- the object's pixels drawn over those in the buffer
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+draw_object_column (const object_t* obj, int x, int y, 
+		    uint8_t buf[SCROLL_Y_DIM], blit_fn_t draw)
+{
+    const image_t* img = obj_image (obj);	/* object image        */
+    int32_t        obj_x = obj_get_x (obj);	/* object x position   */
+    int32_t        obj_y = obj_get_y (obj);	/* object y position   */
+    int            idx;	/* first pixel of line drawn          */
+    int            imgy;	/* first pixel drawn from object image */
+
+    /* Is object outside of the line we're drawing? */
+    if (x < obj_x || x >= obj_x + img->hdr.width ||
+	y + SCROLL_Y_DIM <= obj_y || y >= obj_y + img->hdr.height) {
+	return;
+    }
+
+    /* 
+     * The y offsets depend on whether the object starts below or 
+     * above the starting point for the line being drawn.
+     */
+    if (y <= obj_y) {
+	idx = obj_y - y;
+	imgy = 0;
+    } else {
+	idx = 0;
+	imgy = y - obj_y;
+    }
+
+    /* Copy the object's pixel data, skipping transparent pixels. */
+    draw_column (buf + idx, img, x - obj_x, imgy,
+		 (SCROLL_Y_DIM - idx < img->hdr.height - imgy ?
+		  imgy + SCROLL_Y_DIM - idx : img->hdr.height), draw);
+}
+
+
+/* 
+ * fill_horiz_buffer
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the leftmost 
+ *                pixel of a line to be drawn on the screen, this routine 
+ *                produces an image of the line.  Each pixel on the line
+ *                is represented as a single byte in the image.
+ *
+ *                Note that this routine draws both the room photo and
+ *                the objects in the room.
+ *
+ *   INPUTS: (x,y) -- leftmost pixel of line to be drawn 
+ *   OUTPUTS: buf -- buffer holding image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
+{
+    int            idx;   /* loop index over pixels in the line          */ 
+    object_t*      obj;   /* object in the current room                  */
+    object_t* const* objs; /* objects that may overlap the line         */
+    int32_t        n_objs; /* number of such objects                     */
+    int32_t        i;     /* loop index over objects                     */
+    blit_fn_t      draw;  /* draws object pixels                         */
+    const photo_t* view;  /* room photo                                  */
+
+    /* Get pointer to current photo of current room. */
+    view = room_photo (cur_room);
+
+    /* Copy the line from the composited layer if there is one. */
+    if (NULL != get_layer (view)) {
+	copy_layer_row (x, y, SCROLL_X_DIM, buf);
+	return;
+    }
+
+    /* Loop over pixels in line. */
+    draw = pick_blit ();
+    if (NULL != view->tiles) {
+	photo_tiles_fill_row (view->tiles, x, y, SCROLL_X_DIM, buf);
+    } else {
+	for (idx = 0; idx < SCROLL_X_DIM; idx++) {
+	    buf[idx] = (0 <= x + idx && view->hdr.width > x + idx ?
+			view->img[view->hdr.width * y + x + idx] : 0);
+	}
+    }
+
+    /* 
+     * Loop over objects in the current room that may overlap the line,
+     * or over all of them if the room's objects could not be indexed.
+     */
+    n_objs = room_objects_on_row (cur_room, y, &objs);
+    for (i = 0; n_objs > i; i++) {
+	draw_object_rect (objs[i], x, y, x + SCROLL_X_DIM, y + 1, x, y,
+			  SCROLL_X_DIM, buf, draw);
+    }
+    if (0 > n_objs) {
+	for (obj = room_contents_iterate (cur_room); NULL != obj;
+	     obj = obj_next (obj)) {
+	    draw_object_rect (obj, x, y, x + SCROLL_X_DIM, y + 1, x, y,
+			      SCROLL_X_DIM, buf, draw);
+	}
+    }
+}
+
+
+/* 
+ * fill_vert_buffer
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the top pixel of 
+ *                a vertical line to be drawn on the screen, this routine 
+ *                produces an image of the line.  Each pixel on the line
+ *                is represented as a single byte in the image.
+ *
+ *                Note that this routine draws both the room photo and
+ *                the objects in the room.
+ *
+ *   INPUTS: (x,y) -- top pixel of line to be drawn 
+ *   OUTPUTS: buf -- buffer holding image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
+{
+    int            idx;   /* loop index over pixels in the line          */ 
+    object_t*      obj;   /* object in the current room                  */
+    object_t* const* objs; /* objects that may overlap the line         */
+    int32_t        n_objs; /* number of such objects                     */
+    int32_t        i;     /* loop index over objects                     */
+    const photo_t* view;  /* room photo                                  */
+    blit_fn_t      draw;  /* draws object pixels                         */
+    const uint8_t* lay;   /* composited layer of room                    */
+#if COLUMN_LAYER
+    int            lo;    /* first pixel of line within layer            */
+    int            hi;    /* pixel beyond last one of line within layer  */
+#endif
+
+    /* Get pointer to current photo of current room. */
+    view = room_photo (cur_room);
+
+    /* Copy the line from the composited layer if there is one. */
+    if (NULL != (lay = get_layer (view))) {
+#if COLUMN_LAYER
+	lo = (0 > y ? -y : 0);
+	hi = layer_height - y;
+	if (0 > x || layer_width <= x || SCROLL_Y_DIM <= lo || 0 >= hi) {
+	    lo = hi = 0;
+	} else if (SCROLL_Y_DIM < hi) {
+	    hi = SCROLL_Y_DIM;
+	}
+	(void)memset (buf, 0, lo);
+	(void)memcpy (buf + lo, layer_cols + layer_height * x + y + lo,
+		      hi - lo);
+	(void)memset (buf + hi, 0, SCROLL_Y_DIM - hi);
+#else
+	for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
+	    buf[idx] = (0 <= x && layer_width > x && 0 <= y + idx && 
+			layer_height > y + idx ?
+			lay[layer_width * (y + idx) + x] : 0);
+	}
+#endif
+	return;
+    }
+
+    /* Loop over pixels in line. */
+    draw = pick_blit ();
+    if (NULL != view->tiles) {
+	photo_tiles_fill_column (view->tiles, x, y, SCROLL_Y_DIM, buf);
+    } else {
+	for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
+	    buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
+			view->img[view->hdr.width * (y + idx) + x] : 0);
+	}
+    }
+
+    /* 
+     * Loop over objects in the current room that may overlap the line,
+     * or over all of them if the room's objects could not be indexed.
+     */
+    n_objs = room_objects_on_column (cur_room, x, &objs);
+    for (i = 0; n_objs > i; i++) {
+	draw_object_column (objs[i], x, y, buf, draw);
+    }
+    if (0 > n_objs) {
+	for (obj = room_contents_iterate (cur_room); NULL != obj;
+	     obj = obj_next (obj)) {
+	    draw_object_column (obj, x, y, buf, draw);
+	}
+    }
+}
+
+
+/*
+ * fill_rect_buffer
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the upper left
+ *                pixel of a rectangle of w by h pixels, fills a buffer
+ *                with the pixels of the rectangle, row by row, in the
+ *                same way as fill_horiz_buffer fills one row.  Objects
+ *                that overlap the rectangle are found once for each
+ *                band of the room's object index (see world.h) that it
+ *                covers rather than once per line.  Rectangles
+ *                taller than they are wide, such as the strips exposed
+ *                by scrolling sideways, are filled a column at a time.
+ *   INPUTS: (x,y) -- upper left pixel of rectangle to be drawn
+ *           (w,h) -- width and height of rectangle
+ *           stride -- distance in buffer from one row to the next
+ *   OUTPUTS: buf -- buffer holding image data for the rectangle
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_rect_buffer (int x, int y, int w, int h, int stride, 
+		  unsigned char* buf)
+{
+    int            idx;   /* loop index over pixels in a row             */
+    int            row;   /* loop index over rows of rectangle           */
+    int            i;     /* loop index over part of a column or objects */
+    object_t*      obj;   /* loop index over objects in the room         */
+    object_t* const* objs; /* objects that may overlap a band            */
+    int32_t        n_objs; /* number of such objects                     */
+    int32_t        lo;    /* first row or column of band in rectangle    */
+    int32_t        hi;    /* row or column beyond band in rectangle      */
+    blit_fn_t      draw;  /* draws object pixels                         */
+    const photo_t* view;  /* room photo                                  */
+    uint8_t*       dst;   /* first pixel of row in buffer                */
+    uint8_t        col[SCROLL_Y_DIM]; /* part of a column of a tiled photo */
+    int            n;     /* pixels in part of column                    */
+
+    /* Get pointer to current photo of current room. */
+    view = room_photo (cur_room);
+
+    /* Copy the rectangle from the composited layer if there is one. */
+    if (NULL != get_layer (view)) {
+#if COLUMN_LAYER
+	if (w < h) {
+	    for (idx = 0; w > idx; idx++) {
+		copy_layer_column (x + idx, y, h, buf + idx, stride);
+	    }
+	    return;
+	}
+#endif
+	for (row = 0; h > row; row++) {
+	    copy_layer_row (x, y + row, w, buf + stride * row);
+	}
+	return;
+    }
+
+    /* Fill the rectangle from the photo. */
+    if (NULL != view->tiles && w < h) {
+	for (idx = 0; w > idx; idx++) {
+	    for (row = 0; h > row; row += n) {
+		n = (h - row < SCROLL_Y_DIM ? h - row : SCROLL_Y_DIM);
+		photo_tiles_fill_column (view->tiles, x + idx, y + row, n, 
+					 col);
+		for (i = 0; n > i; i++) {
+		    buf[stride * (row + i) + idx] = col[i];
+		}
+	    }
+	}
+    } else if (NULL != view->tiles) {
+	for (row = 0; h > row; row++) {
+	    photo_tiles_fill_row (view->tiles, x, y + row, w, 
+				  buf + stride * row);
+	}
+    } else {
+	for (row = 0; h > row; row++) {
+	    dst = buf + stride * row;
+	    for (idx = 0; w > idx; idx++) {
+		dst[idx] = (0 <= x + idx && view->hdr.width > x + idx ?
+			    view->img[view->hdr.width * (y + row) + x + idx] :
+			    0);
+	    }
+	}
+    }
+
+    /* 
+     * Draw the objects that may overlap the rectangle one band of the
+     * room's object index at a time, by columns for rectangles taller 
+     * than they are wide and by rows otherwise, clipping each object to
+     * the band.  Bands hold disjoint pixels and list their objects in
+     * drawing order.  If the room's objects could not be indexed, all
+     * of them are drawn over the whole rectangle instead.
+     */
+    draw = pick_blit ();
+    n_objs = 0;
+    if (w < h) {
+	for (lo = x; x + w > lo && 0 <= n_objs; lo = hi) {
+	    hi = (lo & ~(OBJ_BAND_SIZE - 1)) + OBJ_BAND_SIZE;
+	    hi = (x + w < hi ? x + w : hi);
+	    n_objs = room_objects_on_column (cur_room, lo, &objs);
+	    for (i = 0; n_objs > i; i++) {
+		draw_object_rect (objs[i], lo, y, hi, y + h, x, y, stride,
+				  buf, draw);
+	    }
+	}
+    } else {
+	for (lo = y; y + h > lo && 0 <= n_objs; lo = hi) {
+	    hi = (lo & ~(OBJ_BAND_SIZE - 1)) + OBJ_BAND_SIZE;
+	    hi = (y + h < hi ? y + h : hi);
+	    n_objs = room_objects_on_row (cur_room, lo, &objs);
+	    for (i = 0; n_objs > i; i++) {
+		draw_object_rect (objs[i], x, lo, x + w, hi, x, y, stride,
+				  buf, draw);
+	    }
+	}
+    }
+    if (0 > n_objs) {
+	for (obj = room_contents_iterate (cur_room); NULL != obj;
+	     obj = obj_next (obj)) {
+	    draw_object_rect (obj, x, y, x + w, y + h, x, y, stride, buf, 
+			      draw);
+	}
+    }
+}
+
+
+/*
+ * fill_planar_buffer
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the upper left
+ *                pixel of a rectangle of w by h pixels, copies the 
+ *                pixels of the rectangle straight into the four mode X
+ *                planes of a build buffer, if the current room has a
+ *                planar layer that covers the rectangle.  Each row of
+ *                a plane is then a single copy.  Strips no more than
+ *                four pixels wide, which have at most one column in
+ *                each plane, are declined: they are copied faster from
+ *                the column-major layer (see fill_rect_buffer).
+ *   INPUTS: (x,y) -- upper left pixel of rectangle to be drawn
+ *           (w,h) -- width and height of rectangle
+ *           stride -- distance in each plane from one row to the next
+ *   OUTPUTS: planes -- planes[k] receives the pixels with x coordinates
+ *                      equal to k modulo 4; the pixel at (x + i, y + j)
+ *                      is written at planes[(x + i) & 3][stride * j +
+ *                      ((x + i) >> 2) - (x >> 2)]
+ *   RETURN VALUE: 0 on success, or -1 if the rectangle must be filled
+ *                 some other way (nothing is written)
+ *   SIDE EFFECTS: none
+ */
+int
+fill_planar_buffer (int x, int y, int w, int h, int stride, 
+		    unsigned char* planes[4])
+{
+#if PLANAR_LAYER
+    const uint8_t* src;   /* first pixel of plane's part of rectangle   */
+    uint8_t*       dst;   /* where it goes                              */
+    int            k;     /* loop index over planes                     */
+    int            row;   /* loop index over rows of rectangle          */
+    int            first; /* first column of rectangle in plane         */
+    int            n;     /* pixels of each row of rectangle in plane   */
+    int            pw;    /* bytes in each row of a plane of the layer  */
+
+    if (4 >= w || NULL == get_layer (room_photo (cur_room)) || 0 > x || 
+	0 > y || layer_width < x + w || layer_height < y + h) {
+	return -1;
+    }
+    pw = layer_width >> 2;
+    for (k = 0; 4 > k; k++) {
+	first = x + ((k - x) & 3);
+	if (x + w <= first) {
+	    continue;
+	}
+	n = (x + w - first + 3) >> 2;
+	src = layer_planes + pw * (layer_height * k + y) + (first >> 2);
+	dst = planes[k] + (first >> 2) - (x >> 2);
+
+	/* Strips one pixel wide in the plane are copied byte by byte. */
+	if (1 == n) {
+	    for (row = 0; h > row; row++) {
+		dst[stride * row] = src[pw * row];
+	    }
+	    continue;
+	}
+	for (row = 0; h > row; row++) {
+	    (void)memcpy (dst + stride * row, src + pw * row, n);
+	}
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+/* 
+ * image_height
+ *   DESCRIPTION: Get height of object image in pixels.
+ *   INPUTS: im -- object image pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: height of object image im in pixels
+ *   SIDE EFFECTS: none
+ */
+uint32_t 
+image_height (const image_t* im)
+{
+    return im->hdr.height;
+}
+
+
+/* 
+ * image_width
+ *   DESCRIPTION: Get width of object image in pixels.
+ *   INPUTS: im -- object image pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: width of object image im in pixels
+ *   SIDE EFFECTS: none
+ */
+uint32_t 
+image_width (const image_t* im)
+{
+    return im->hdr.width;
+}
+
+/* 
+ * photo_height
+ *   DESCRIPTION: Get height of room photo in pixels.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: height of room photo p in pixels
+ *   SIDE EFFECTS: none
+ */
+uint32_t 
+photo_height (const photo_t* p)
+{
+    return p->hdr.height;
+}
+
+
+/* 
+ * photo_width
+ *   DESCRIPTION: Get width of room photo in pixels.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: width of room photo p in pixels
+ *   SIDE EFFECTS: none
+ */
+uint32_t 
+photo_width (const photo_t* p)
+{
+    return p->hdr.width;
+}
+
+
+/* 
+ * photo_size
+ *   DESCRIPTION: Get the memory taken by a room photo's pixels: all of
+ *                them for an ordinary photo, or just the tables of a
+ *                tiled photo, whose tiles are held in a cache of fixed
+ *                size.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: size in bytes
+ *   SIDE EFFECTS: none
+ */
+uint32_t 
+photo_size (const photo_t* p)
+{
+    if (NULL != p->tiles) {
+	return photo_tiles_size (p->tiles);
+    }
+    return p->hdr.width * p->hdr.height;
+}
+
+
+/* 
+ * hash_photo
+ *   DESCRIPTION: Compute the hash by which a photo is matched against
+ *                identical photos when it is shared.
+ *   INPUTS: p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: hash of the photo's header, palette, and pixels
+ *   SIDE EFFECTS: none
+ */
+static uint64_t
+hash_photo (const photo_t* p)
+{
+    uint64_t h;		/* hash so far */
+
+    h = photo_hash (&p->hdr, sizeof (p->hdr), PHOTO_HASH_INIT);
+    h = photo_hash (p->palette, sizeof (p->palette), h);
+    if (NULL != p->img) {
+	h = photo_hash (p->img, p->hdr.width * p->hdr.height, h);
+    }
+    return h;
+}
+
+
+/* 
+ * swap_refined
+ *   DESCRIPTION: Copy a photo's completed refinement into it, replacing
+ *                its 2:2:2 pixels and unused palette, and rehash it so
+ *                that it is shared by its refined contents.  The copy
+ *                is made under share_lock, where other photos are
+ *                compared with it.  If p is the photo shown, its
+ *                composited layer is marked for rebuilding; the layer
+ *                is only reused for the photo shown, and only the game
+ *                thread swaps that photo, so the refinement thread
+ *                never touches the layer.  Must be called with
+ *                refine_lock held.
+ *   INPUTS: p -- the photo, whose refinement is complete
+ *   OUTPUTS: p -- palette, pixels, and share hash replaced
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the refinement; may mark the layer for rebuilding
+ */
+static void
+swap_refined (photo_t* p)
+{
+    refine_t* j = p->refine;	/* the refinement */
+
+    (void)pthread_mutex_lock (&share_lock);
+    (void)memcpy (p->palette, j->fine->palette, sizeof (p->palette));
+    (void)memcpy (p->img, j->fine->img, p->hdr.width * p->hdr.height);
+    p->share.hash = hash_photo (p);
+    (void)pthread_mutex_unlock (&share_lock);
+    free (j->fine);
+    free (j);
+    p->refine = NULL;
+    if (shown == p && layer_photo == p) {
+	layer_photo = NULL;
+    }
+}
+
+
+/* 
+ * show_photo
+ *   DESCRIPTION: Record the photo about to be shown on the screen.  If it
+ *                is still waiting to be refined, its refinement is moved
+ *                to the front of the queue; if the refinement is already
+ *                complete, it is swapped in.  Must be called with 
+ *                refine_lock held.
+ *   INPUTS: p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change the photo's palette and pixels and mark
+ *                 the layer for rebuilding
+ */
+static void
+show_photo (photo_t* p)
+{
+    refine_t** jp;	/* link to refinement in queue */
+
+    shown = p;
+    if (NULL == p->refine) {
+	return;
+    }
+    if (NULL != p->refine->fine) {
+	swap_refined (p);
+	return;
+    }
+    for (jp = &refine_queue; NULL != *jp; jp = &(*jp)->next) {
+	if (p->refine == *jp) {
+	    *jp = p->refine->next;
+	    p->refine->next = refine_queue;
+	    refine_queue = p->refine;
+	    return;
+	}
+    }
+}
+
+
+/* 
+ * prep_room
+ *   DESCRIPTION: Prepare a new room for display: set up the VGA palette
+ *                registers for the room's photo and composite the photo
+ *                and the room's objects for drawing.
+ *   INPUTS: r -- pointer to the new room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes recorded cur_room for this file; changes the
+ *                 VGA palette
+ */
+void
+prep_room (const room_t* r)
+{
+    photo_t* view;	/* photo of the new room */
+
+    /* Record the current room. */
+    cur_room = r;
+
+    /* Set up the palette for the room's photo. */
+    view = room_photo (r);
+    (void)pthread_mutex_lock (&refine_lock);
+    show_photo (view);
+    set_palette (view->palette);
+    (void)pthread_mutex_unlock (&refine_lock);
+
+    /* Composite the room's photo and objects for drawing. */
+    (void)get_layer (view);
+}
+
+
+/* 
+ * refine_room
+ *   DESCRIPTION: Replace the 2:2:2 pixels of the current room's photo
+ *                with the photo's refined palette and pixels once these
+ *                are ready (see photo_start_refine), and set up the VGA
+ *                palette for them.  Called on each tick of the game.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the room must be redrawn, or 0 if not
+ *   SIDE EFFECTS: may change the photo and the VGA palette
+ */
+int32_t
+refine_room ()
+{
+    int32_t rval = 0;	/* return value */
+
+    (void)pthread_mutex_lock (&refine_lock);
+    if (NULL != shown && NULL != shown->refine &&
+	NULL != shown->refine->fine) {
+	swap_refined (shown);
+	set_palette (shown->palette);
+	rval = 1;
+    }
+    (void)pthread_mutex_unlock (&refine_lock);
+    return rval;
+}
+
+
+/* 
+ * load_image_file
+ *   DESCRIPTION: Read a photo or object image file into memory.  The
+ *                header is checked, then all pixel data are pulled in
+ *                with a single read and the rows are flipped in place,
+ *                since the file stores the bottom row first whereas in
+ *                memory we store the data from top to bottom.  Pixels
+ *                are otherwise left exactly as stored in the file.
+ *                Like all image files, the file is taken from the asset
+ *                pack if it is packed there (see pack.h).
+ *
+ *                The pixels are placed prefix bytes into the block of
+ *                memory allocated for them, leaving room for the caller
+ *                to put a structure in front.  The block comes from the
+ *                object image arena if arena is non-zero, or from malloc
+ *                otherwise.  (Arena memory is not reclaimed on failure.)
+ *   INPUTS: fname -- file name for input
+ *           max_width -- largest image width allowed
+ *           max_height -- largest image height allowed
+ *           pixel_size -- number of bytes per pixel in the file (at
+ *                         most sizeof (uint16_t))
+ *           prefix -- bytes to leave in front of the pixels (a multiple
+ *                     of PIXEL_ALIGN)
+ *           arena -- 1 to allocate from the object image arena
+ *   OUTPUTS: hdr -- the image header read from the file
+ *   RETURN VALUE: pointer to the block holding the pixel data on success,
+ *                 or NULL on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the pixel data
+ */
+static void*
+load_image_file (const char* fname, photo_header_t* hdr, uint32_t max_width,
+		 uint32_t max_height, size_t pixel_size, size_t prefix,
+		 int32_t arena)
+{
+    FILE*    in;		/* input file                         */
+    uint8_t* block = NULL;	/* memory block allocated             */
+    uint8_t* pix;		/* pixel data                         */
+    uint8_t  row[MAX_PHOTO_WIDTH * sizeof (uint16_t)]; /* row swap space */
+    size_t   row_size;		/* bytes per row                      */
+    uint32_t y;			/* index over rows in top half        */
+
+    /* 
+     * Open the file, read the header, and do some sanity checks on it.
+     * If anything fails, clean up as necessary and return NULL.
+     */
+    if (NULL == (in = pack_fopen (fname)) ||
+	1 != fread (hdr, sizeof (*hdr), 1, in) ||
+	max_width < hdr->width || max_height < hdr->height ||
+	sizeof (row) < (row_size = hdr->width * pixel_size)) {
+	if (NULL != in) {
+	    (void)fclose (in);
+	}
+	return NULL;
+    }
+
+    /* Allocate space to hold the pixels, and read them all at once. */
+    if (arena) {
+	(void)pthread_mutex_lock (&image_lock);
+	block = arena_alloc (&image_arena, prefix + row_size * hdr->height,
+			     PIXEL_ALIGN);
+	(void)pthread_mutex_unlock (&image_lock);
+    } else {
+	block = malloc (prefix + row_size * hdr->height);
+    }
+    if (NULL == block ||
+	1 != fread (pix = block + prefix, row_size * hdr->height, 1, in)) {
+	if (NULL != block && !arena) {
+	    free (block);
+	}
+	(void)fclose (in);
+	return NULL;
+    }
+    (void)fclose (in);
+
+    /* Swap rows top to bottom. */
+    for (y = 0; hdr->height / 2 > y; y++) {
+	(void)memcpy (row, pix + row_size * y, row_size);
+	(void)memcpy (pix + row_size * y, 
+		      pix + row_size * (hdr->height - 1 - y), row_size);
+	(void)memcpy (pix + row_size * (hdr->height - 1 - y), row, row_size);
+    }
+
+    return block;
+}
+
+
+/* 
+ * share_find
+ *   DESCRIPTION: Find a shared photo or image read from a given file and
+ *                add a reference to it.  Must be called with share_lock
+ *                held.
+ *   INPUTS: list -- list of shared photos or images
+ *           fname -- file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the photo or image, or NULL if none was read from fname
+ *   SIDE EFFECTS: increments the reference count of the item found
+ */
+static void*
+share_find (shared_t* list, const char* fname)
+{
+    for (; NULL != list; list = list->next) {
+	if (0 == strcmp (list->fname, fname)) {
+	    list->refs++;
+	    return list->item;
+	}
+    }
+    return NULL;
+}
+
+
+/* 
+ * share_add
+ *   DESCRIPTION: Share a newly read photo or image.  If another thread
+ *                has meanwhile read the same file, or an item with the
+ *                same contents is already shared, that item gains a
+ *                reference instead, and the new one is left unshared
+ *                for the caller to free.
+ *   INPUTS: list -- list of shared photos or images
+ *           s -- sharing information of new item, with hash and item
+ *                filled in
+ *           fname -- file from which new item was read
+ *           same -- function to compare contents of two items
+ *   OUTPUTS: *list -- new item added, if it is shared
+ *   RETURN VALUE: the item to use (s->item or an existing item), or
+ *                 NULL if the new item can't be shared for lack of
+ *                 memory
+ *   SIDE EFFECTS: copies fname; raises a reference count
+ */
+static void*
+share_add (shared_t** list, shared_t* s, const char* fname, same_fn_t same)
+{
+    shared_t* t;	/* loop index over shared items */
+    void*     item;	/* item to be used              */
+
+    (void)pthread_mutex_lock (&share_lock);
+    if (NULL == (item = share_find (*list, fname))) {
+	for (t = *list; NULL != t; t = t->next) {
+	    if (t->hash == s->hash && same (t->item, s->item)) {
+		t->refs++;
+		item = t->item;
+		break;
+	    }
+	}
+    }
+    if (NULL == item && NULL != (s->fname = strdup (fname))) {
+	s->refs = 1;
+	s->next = *list;
+	*list = s;
+	item = s->item;
+    }
+    (void)pthread_mutex_unlock (&share_lock);
+    return item;
+}
+
+
+/* 
+ * share_drop
+ *   DESCRIPTION: Drop a reference to a shared photo or image, removing
+ *                it from its list when the last reference goes away.
+ *   INPUTS: list -- list of shared photos or images
+ *           s -- sharing information of the item
+ *   OUTPUTS: *list -- item removed, if it has no more references
+ *   RETURN VALUE: 1 if the item should now be freed, or 0 if not
+ *   SIDE EFFECTS: frees the copy of the item's file name if it is freed
+ */
+static int32_t
+share_drop (shared_t** list, shared_t* s)
+{
+    shared_t** tp;	/* link to loop index over items */
+
+    (void)pthread_mutex_lock (&share_lock);
+    if (0 != --s->refs) {
+	(void)pthread_mutex_unlock (&share_lock);
+	return 0;
+    }
+    for (tp = list; s != *tp; tp = &(*tp)->next) {
+    }
+    *tp = s->next;
+    (void)pthread_mutex_unlock (&share_lock);
+    free (s->fname);
+    return 1;
+}
+
+
+/* 
+ * same_image
+ *   DESCRIPTION: Check whether two object images have the same contents.
+ *   INPUTS: a, b -- the images (image_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the images match, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+same_image (const void* a, const void* b)
+{
+    const image_t* ia = a;	/* first image  */
+    const image_t* ib = b;	/* second image */
+
+    return (ia->hdr.width == ib->hdr.width &&
+	    ia->hdr.height == ib->hdr.height &&
+	    0 == memcmp (ia->img, ib->img, ia->hdr.width * ia->hdr.height));
+}
+
+
+/* 
+ * find_raw
+ *   DESCRIPTION: Look for a raw photo or object image (see pack.h) in the
+ *                asset pack, so that it can be used in place.
+ *   INPUTS: fname -- file name
+ *           magic -- magic sequence of the raw form wanted
+ *           hdr_size -- size of the raw form's header, which holds the
+ *                       magic sequence followed by a photo header
+ *           max_width -- largest image width allowed
+ *           max_height -- largest image height allowed
+ *   OUTPUTS: hdr -- the image header
+ *   RETURN VALUE: pointer to the file's contents in the pack, with the
+ *                 pixels at hdr_size bytes in, or NULL if the file is
+ *                 not packed in that raw form (or is not valid)
+ *   SIDE EFFECTS: none
+ */
+static const uint8_t*
+find_raw (const char* fname, const char* magic, size_t hdr_size,
+	  uint32_t max_width, uint32_t max_height, photo_header_t* hdr)
+{
+    const uint8_t* data;	/* packed file contents */
+    uint32_t       size;	/* size of contents     */
+
+    if (NULL == (data = pack_find (fname, &size)) || hdr_size > size ||
+	0 != memcmp (data, magic, 4)) {
+	return NULL;
+    }
+    (void)memcpy (hdr, data + 4, sizeof (*hdr));
+    if (max_width < hdr->width || max_height < hdr->height ||
+	size - hdr_size < (uint32_t)hdr->width * hdr->height) {
+	return NULL;
+    }
+    return data;
+}
+
+
+/* 
+ * load_obj_image
+ *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
+ *                photo file and create an image structure from it.
+ *                The structure and pixels share one block of memory
+ *                from the object image arena.  A raw object image in
+ *                the asset pack is used in place instead: only the 
+ *                structure is allocated, and its pixels are those in
+ *                the pack.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated image on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: allocates memory for the image from the arena
+ */
+static image_t*
+load_obj_image (const char* fname)
+{
+    image_t*       img;	/* image structure         */
+    photo_header_t hdr;	/* image header            */
+    const uint8_t* raw;	/* raw image in asset pack */
+
+    if (NULL != (raw = find_raw (fname, PACK_RAW_OBJECT, 
+				 sizeof (pack_object_header_t),
+				 MAX_OBJECT_WIDTH, MAX_OBJECT_HEIGHT, &hdr))) {
+	(void)pthread_mutex_lock (&image_lock);
+	img = arena_alloc (&image_arena, sizeof (*img), PIXEL_ALIGN);
+	(void)pthread_mutex_unlock (&image_lock);
+	if (NULL != img) {
+	    img->hdr = hdr;
+	    img->img = (uint8_t*)raw + sizeof (pack_object_header_t);
+	}
+	return img;
+    }
+
+    /* Read the header and pixels, leaving room for the structure. */
+    if (NULL == (img = load_image_file (fname, &hdr, MAX_OBJECT_WIDTH, 
+					MAX_OBJECT_HEIGHT, sizeof (uint8_t),
+					PIXEL_OFFSET (image_t), 1))) {
+	return NULL;
+    }
+    img->hdr = hdr;
+    img->img = (uint8_t*)img + PIXEL_OFFSET (image_t);
+
+    /* All done.  Return success. */
+    return img;
+}
+
+
+/* 
+ * make_spans
+ *   DESCRIPTION: Find the runs of opaque pixels in each row and each
+ *                column of an object image, so that drawing the image
+ *                need not look at its transparent pixels (see draw_row
+ *                and draw_column), and copy the image column by column
+ *                so that its columns are drawn like its rows.  The runs
+ *                and the copy are allocated from the object image
+ *                arena.  If they can't be, the image is drawn pixel by
+ *                pixel.
+ *   INPUTS: img -- the image
+ *   OUTPUTS: img -- row_span, col_span, span, and cols filled in
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: allocates memory for the runs from the arena
+ */
+static void
+make_spans (image_t* img)
+{
+    const uint8_t* pix = img->img;	/* image pixels                  */
+    uint32_t       w = img->hdr.width;	/* image width                   */
+    uint32_t       h = img->hdr.height;	/* image height                  */
+    uint32_t       n_spans;	/* runs in image                 */
+    uint32_t       x;		/* index over columns            */
+    uint32_t       y;		/* index over rows               */
+    uint32_t       start;	/* first pixel of current run    */
+    void*          block;	/* memory for runs               */
+
+    img->row_span = NULL;
+    img->col_span = NULL;
+    img->span = NULL;
+    img->cols = NULL;
+
+    /* Count the runs (each appears once in a row and once in a column). */
+    n_spans = 0;
+    for (y = 0; h > y; y++) {
+	for (x = 0; w > x; x++) {
+	    if (OBJ_CLR_TRANSP != pix[w * y + x] &&
+		(0 == x || OBJ_CLR_TRANSP == pix[w * y + x - 1])) {
+		n_spans++;
+	    }
+	    if (OBJ_CLR_TRANSP != pix[w * y + x] &&
+		(0 == y || OBJ_CLR_TRANSP == pix[w * (y - 1) + x])) {
+		n_spans++;
+	    }
+	}
+    }
+
+    (void)pthread_mutex_lock (&image_lock);
+    block = arena_alloc (&image_arena, 
+			 n_spans * sizeof (img->span[0]) +
+			 (h + 1 + w + 1) * sizeof (img->row_span[0]) + w * h,
+			 sizeof (img->row_span[0]));
+    (void)pthread_mutex_unlock (&image_lock);
+    if (NULL == block) {
+	return;
+    }
+    img->row_span = block;
+    img->col_span = img->row_span + h + 1;
+    img->span = (obj_span_t*)(img->col_span + w + 1);
+    img->cols = (uint8_t*)(img->span + n_spans);
+
+    /* Record the runs of each row, then of each column. */
+    n_spans = 0;
+    for (y = 0; h > y; y++) {
+	img->row_span[y] = n_spans;
+	for (x = 0; w > x; ) {
+	    if (OBJ_CLR_TRANSP == pix[w * y + x]) {
+		x++;
+		continue;
+	    }
+	    for (start = x; w > x && OBJ_CLR_TRANSP != pix[w * y + x]; x++) {
+	    }
+	    img->span[n_spans].start = start;
+	    img->span[n_spans].len = x - start;
+	    n_spans++;
+	}
+    }
+    img->row_span[h] = n_spans;
+    for (x = 0; w > x; x++) {
+	img->col_span[x] = n_spans;
+	for (y = 0; h > y; ) {
+	    if (OBJ_CLR_TRANSP == pix[w * y + x]) {
+		y++;
+		continue;
+	    }
+	    for (start = y; h > y && OBJ_CLR_TRANSP != pix[w * y + x]; y++) {
+	    }
+	    img->span[n_spans].start = start;
+	    img->span[n_spans].len = y - start;
+	    n_spans++;
+	}
+    }
+    img->col_span[w] = n_spans;
+    for (x = 0; w > x; x++) {
+	for (y = 0; h > y; y++) {
+	    img->cols[h * x + y] = pix[w * y + x];
+	}
+    }
+}
+
+
+/* 
+ * read_obj_image
+ *   DESCRIPTION: Get an object image from a file, sharing the image if
+ *                the same file, or an identical image, has already been
+ *                read.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the (possibly shared) image on success, or
+ *                 NULL on failure
+ *   SIDE EFFECTS: may allocate memory for the image; adds a reference
+ *                 to the image
+ */
+image_t*
+read_obj_image (const char* fname)
+{
+    image_t* img;	/* new image   */
+    image_t* use;	/* image to use */
+
+    (void)pthread_mutex_lock (&share_lock);
+    use = share_find (shared_images, fname);
+    (void)pthread_mutex_unlock (&share_lock);
+    if (NULL != use || NULL == (img = load_obj_image (fname))) {
+	return use;
+    }
+
+    make_spans (img);
+    img->share.hash = photo_hash (&img->hdr, sizeof (img->hdr), 
+				  PHOTO_HASH_INIT);
+    img->share.hash = photo_hash (img->img, img->hdr.width * img->hdr.height,
+				  img->share.hash);
+    img->share.item = img;
+    /* 
+     * An unshared duplicate is simply abandoned: arena memory is only
+     * reclaimed all at once.
+     */
+    return share_add (&shared_images, &img->share, fname, same_image);
+}
+
+
+/* 
+ * free_obj_image
+ *   DESCRIPTION: Drop a reference to an object image from read_obj_image.
+ *                When no references remain, the image is no longer
+ *                shared, but its arena memory is not reclaimed.
+ *   INPUTS: img -- the image
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may stop sharing the image
+ */
+void
+free_obj_image (image_t* img)
+{
+    (void)share_drop (&shared_images, &img->share);
+}
+
+/* 
+ * alloc_photo
+ *   DESCRIPTION: Allocate a photo structure and its pixels as one block,
+ *                with the pixels starting on a cache line.
+ *   INPUTS: hdr -- photo dimensions
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the photo, with hdr and img filled in, or
+ *                 NULL on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo; free it
+ *                 with a single call to free
+ */
+static photo_t*
+alloc_photo (const photo_header_t* hdr)
+{
+    void*    block;	/* memory for photo */
+    photo_t* p;		/* photo structure  */
+
+    if (0 != posix_memalign (&block, PIXEL_ALIGN, PIXEL_OFFSET (photo_t) +
+			     hdr->width * hdr->height * sizeof (p->img[0]))) {
+	return NULL;
+    }
+    p = block;
+    p->hdr = *hdr;
+    p->img = (uint8_t*)block + PIXEL_OFFSET (photo_t);
+    p->tiles = NULL;
+    p->refine = NULL;
+    return p;
+}
+
+
+/* 
+ * destroy_photo
+ *   DESCRIPTION: Free a photo's memory, closing its tiles if it is tiled
+ *                and dropping any pending refinement.
+ *   INPUTS: p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the photo
+ */
+static void
+destroy_photo (photo_t* p)
+{
+    refine_t** jp;	/* link to refinement in queue */
+    refine_t*  j;	/* the refinement              */
+
+    (void)pthread_mutex_lock (&refine_lock);
+    if (shown == p) {
+	shown = NULL;
+    }
+    if (NULL != (j = p->refine)) {
+	if (refining == j) {
+	    /* The refinement thread frees it when done. */
+	    j->p = NULL;
+	} else {
+	    for (jp = &refine_queue; NULL != *jp; jp = &(*jp)->next) {
+		if (j == *jp) {
+		    *jp = j->next;
+		    break;
+		}
+	    }
+	    free (j->pix);
+	    free (j->fine);
+	    free (j);
+	}
+    }
+    (void)pthread_mutex_unlock (&refine_lock);
+    if (NULL != p->tiles) {
+	photo_tiles_close (p->tiles);
+    }
+    free (p);
+}
+
+
+/* 
+ * quantize_cached
+ *   DESCRIPTION: Fill in a photo's palette and pixels from its 5:6:5
+ *                pixels, using the quantized photo cache (see
+ *                photo_cache.h) when it holds a match for the photo and
+ *                quantizing (and updating the cache) otherwise.
+ *   INPUTS: fname -- photo file name
+ *           pix -- 5:6:5 pixels, top row first
+ *           p -- photo from alloc_photo
+ *   OUTPUTS: p -- palette and img filled in
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: may write the photo's cache file
+ */
+static int32_t
+quantize_cached (const char* fname, const uint16_t* pix, photo_t* p)
+{
+    uint32_t n_pix = p->hdr.width * p->hdr.height; /* pixels in photo */
+    uint64_t hash;	/* hash of photo file contents */
+
+    hash = photo_hash (&p->hdr, sizeof (p->hdr), PHOTO_HASH_INIT);
+    hash = photo_hash (pix, n_pix * sizeof (pix[0]), hash);
+    if (0 == photo_cache_load (fname, hash, &p->hdr, p->palette, p->img)) {
+	return 0;
+    }
+    if (0 != quantize (pix, n_pix, p->palette, p->img)) {
+	return -1;
+    }
+    photo_cache_store (fname, hash, &p->hdr, p->palette, p->img);
+    return 0;
+}
+
+
+/* 
+ * refine_later
+ *   DESCRIPTION: In progressive mode (see photo_start_refine), fill in a
+ *                photo from its 5:6:5 pixels right away, and leave the
+ *                choice of palette colors to the refinement thread.
+ *                The photo is taken from the quantized photo cache if
+ *                the cache holds a match.  Otherwise its pixels are
+ *                mapped to the 64 fixed 2:2:2 colors also used by object
+ *                images, and the photo is queued to be quantized.
+ *   INPUTS: fname -- photo file name (not copied)
+ *           pix -- 5:6:5 pixels, top row first
+ *           p -- photo from alloc_photo
+ *   OUTPUTS: p -- palette and img filled in
+ *            pix -- set to NULL if the pixels were taken by the queue
+ *   RETURN VALUE: 0 on success, or -1 if not in progressive mode (or
+ *                 if out of memory), in which case the photo must be
+ *                 quantized as usual
+ *   SIDE EFFECTS: dynamically allocates memory for the refinement
+ */
+static int32_t
+refine_later (const char* fname, uint16_t** pix, photo_t* p)
+{
+    uint32_t   n_pix = p->hdr.width * p->hdr.height; /* pixels in photo */
+    uint32_t   idx;	/* index over pixels             */
+    refine_t*  j;	/* the refinement                */
+    refine_t** jp;	/* link to end of queue          */
+    uint64_t   hash;	/* hash of photo file contents   */
+    int32_t    running;	/* 1 if refinement thread runs   */
+
+    (void)pthread_mutex_lock (&refine_lock);
+    running = refine_running;
+    (void)pthread_mutex_unlock (&refine_lock);
+    if (!running || NULL == (j = malloc (sizeof (*j)))) {
+	return -1;
+    }
+    hash = photo_hash (&p->hdr, sizeof (p->hdr), PHOTO_HASH_INIT);
+    hash = photo_hash (*pix, n_pix * sizeof ((*pix)[0]), hash);
+    if (0 == photo_cache_load (fname, hash, &p->hdr, p->palette, p->img)) {
+	free (j);
+	return 0;
+    }
+
+    /* 
+     * 16-bit pixel is coded as 5:6:5 RGB (5 bits red, 6 bits green,
+     * and 5 bits blue).  We change to 2:2:2, which we've set for the
+     * game objects, until the photo's own colors are ready.
+     */
+    for (idx = 0; n_pix > idx; idx++) {
+	p->img[idx] = ((((*pix)[idx] >> 14) << 4) |
+		       ((((*pix)[idx] >> 9) & 0x3) << 2) |
+		       (((*pix)[idx] >> 3) & 0x3));
+    }
+    (void)memset (p->palette, 0, sizeof (p->palette));
+
+    j->p = p;
+    j->fname = fname;
+    j->hdr = p->hdr;
+    j->pix = *pix;
+    j->fine = NULL;
+    j->next = NULL;
+    (void)pthread_mutex_lock (&refine_lock);
+
+    /* The thread may have been stopped meanwhile. */
+    if (!refine_running) {
+	(void)pthread_mutex_unlock (&refine_lock);
+	free (j);
+	return -1;
+    }
+    *pix = NULL;
+    for (jp = &refine_queue; NULL != *jp; jp = &(*jp)->next) {
+    }
+    *jp = j;
+    p->refine = j;
+    (void)pthread_cond_signal (&refine_cv);
+    (void)pthread_mutex_unlock (&refine_lock);
+    return 0;
+}
+
+
+/*
+ * refine_thread
+ *   DESCRIPTION: Quantize queued photos one at a time, until told to 
+ *                stop.  A refined photo not on the screen is swapped in
+ *                at once; the one on the screen is left for refine_room,
+ *                so that its pixels and the VGA palette change together.
+ *   INPUTS: arg -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: changes photos; may write photo cache files
+ */
+static void*
+refine_thread (void* arg)
+{
+    refine_t* j;	/* refinement under way */
+    photo_t*  fine;	/* the refined photo    */
+
+    (void)pthread_mutex_lock (&refine_lock);
+    while (1) {
+	while (refine_running && NULL == refine_queue) {
+	    (void)pthread_cond_wait (&refine_cv, &refine_lock);
+	}
+	if (!refine_running) {
+	    break;
+	}
+	refining = j = refine_queue;
+	refine_queue = j->next;
+
+	/* Quantize without holding the lock. */
+	(void)pthread_mutex_unlock (&refine_lock);
+	if (NULL != (fine = alloc_photo (&j->hdr)) &&
+	    0 != quantize_cached (j->fname, j->pix, fine)) {
+	    free (fine);
+	    fine = NULL;
+	}
+	free (j->pix);
+	j->pix = NULL;
+	(void)pthread_mutex_lock (&refine_lock);
+	refining = NULL;
+
+	/* 
+	 * If the photo has been freed meanwhile, or can't be refined,
+	 * forget about it; a photo that can't be refined keeps its 2:2:2
+	 * pixels.
+	 */
+	if (NULL == j->p || NULL == fine) {
+	    if (NULL != j->p) {
+		j->p->refine = NULL;
+	    }
+	    free (fine);
+	    free (j);
+	    continue;
+	}
+	j->fine = fine;
+	if (shown != j->p) {
+	    swap_refined (j->p);
+	}
+    }
+    (void)pthread_mutex_unlock (&refine_lock);
+    return NULL;
+}
+
+
+/*
+ * photo_start_refine
+ *   DESCRIPTION: Start the refinement thread, which turns on progressive
+ *                loading of room photos.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: creates a thread
+ */
+int32_t
+photo_start_refine ()
+{
+    (void)pthread_mutex_lock (&refine_lock);
+    refine_running = 1;
+    (void)pthread_mutex_unlock (&refine_lock);
+    if (0 != pthread_create (&refine_tid, NULL, refine_thread, NULL)) {
+	(void)pthread_mutex_lock (&refine_lock);
+	refine_running = 0;
+	(void)pthread_mutex_unlock (&refine_lock);
+	return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * photo_stop_refine
+ *   DESCRIPTION: Stop the refinement thread, if running.  Photos still 
+ *                waiting to be refined keep their 2:2:2 pixels.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: waits for the thread to finish any photo under way
+ */
+void
+photo_stop_refine ()
+{
+    refine_t* j;	/* refinement dropped */
+
+    (void)pthread_mutex_lock (&refine_lock);
+    if (!refine_running) {
+	(void)pthread_mutex_unlock (&refine_lock);
+	return;
+    }
+    refine_running = 0;
+    (void)pthread_cond_signal (&refine_cv);
+    (void)pthread_mutex_unlock (&refine_lock);
+    (void)pthread_join (refine_tid, NULL);
+
+    (void)pthread_mutex_lock (&refine_lock);
+    while (NULL != (j = refine_queue)) {
+	refine_queue = j->next;
+	j->p->refine = NULL;
+	free (j->pix);
+	free (j);
+    }
+    (void)pthread_mutex_unlock (&refine_lock);
+}
+
+
+/* 
+ * read_indexed_photo
+ *   DESCRIPTION: Read the rest of a compressed indexed photo file (see
+ *                qphoto.h), whose pixels have already been quantized.
+ *                The rows are decoded one at a time straight into the
+ *                photo's pixel data.
+ *   INPUTS: in -- input file, positioned just after the magic sequence
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+static photo_t*
+read_indexed_photo (FILE* in)
+{
+    photo_t*       p = NULL;	/* photo structure */
+    photo_header_t hdr;		/* photo header    */
+
+    /* 
+     * Read the header, allocate the photo, then read the palette and
+     * decode the pixels.  If anything fails, clean up as necessary and
+     * return NULL.
+     */
+    if (1 != fread (&hdr, sizeof (hdr), 1, in) ||
+	MAX_PHOTO_WIDTH < hdr.width || MAX_PHOTO_HEIGHT < hdr.height ||
+	NULL == (p = alloc_photo (&hdr)) ||
+	1 != fread (p->palette, sizeof (p->palette), 1, in) ||
+	0 != qphoto_read_rows (in, p->img, p->hdr.width, p->hdr.height)) {
+	if (NULL != p) {
+	    free (p);
+	}
+	return NULL;
+    }
+    return p;
+}
+
+
+/* 
+ * read_tiled_photo
+ *   DESCRIPTION: Read the header, palette, and tile index of a tiled
+ *                photo file (see qphoto.h).  No pixels are read until
+ *                they are drawn.
+ *   INPUTS: in -- input file, positioned just after the magic sequence
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo; on success,
+ *                 the photo keeps the file open
+ */
+static photo_t*
+read_tiled_photo (FILE* in)
+{
+    photo_t* p;	/* photo structure */
+
+    if (NULL == (p = malloc (sizeof (*p))) ||
+	1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
+	QPHOTO_MAX_TILED_WIDTH < p->hdr.width || 
+	QPHOTO_MAX_TILED_HEIGHT < p->hdr.height ||
+	1 != fread (p->palette, sizeof (p->palette), 1, in) ||
+	NULL == (p->tiles = photo_tiles_open (in, &p->hdr))) {
+	if (NULL != p) {
+	    free (p);
+	}
+	return NULL;
+    }
+    p->img = NULL;
+    p->refine = NULL;
+    return p;
+}
+
+
+/* 
+ * load_photo
+ *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
+ *                photo file and create a photo structure from it.
+ *                The file is decoded once into a working buffer of
+ *                16-bit pixels (top row first), from which the current
+ *                quantizer (see quantize.h) chooses the photo's 192
+ *                palette colors and maps each pixel to one of them.
+ *                The result is taken from the quantized photo cache
+ *                instead when the cache holds a match for the file.
+ *                In progressive mode, the photo is instead returned
+ *                with 2:2:2 pixels and quantized later.
+ *                A compressed indexed photo (see qphoto.h) may be used
+ *                in place of a photo file; it needs only be decoded.
+ *                A tiled photo is read only up to its tile index.
+ *                A raw photo in the asset pack (see pack.h) is used in
+ *                place: only the structure is allocated, and its pixels
+ *                are those in the pack.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo; may
+ *                 write the photo's cache file
+ */
+static photo_t* 
+load_photo (const char* fname)
+{
+    uint16_t*      pix;	/* 5:6:5 pixels, top row first */
+    photo_t*       p = NULL; /* photo structure        */
+    photo_header_t hdr;	/* photo header                */
+    const uint8_t* raw;	/* raw photo in asset pack     */
+    FILE*          in;	/* input file                  */
+    char           magic[sizeof (QPHOTO_MAGIC) - 1]; /* magic sequence */
+
+    if (NULL != (raw = find_raw (fname, PACK_RAW_PHOTO, 
+				 sizeof (qphoto_header_t), MAX_PHOTO_WIDTH,
+				 MAX_PHOTO_HEIGHT, &hdr))) {
+	if (NULL != (p = malloc (sizeof (*p)))) {
+	    p->hdr = hdr;
+	    (void)memcpy (p->palette, ((const qphoto_header_t*)raw)->palette,
+			  sizeof (p->palette));
+	    p->img = (uint8_t*)raw + sizeof (qphoto_header_t);
+	    p->tiles = NULL;
+	    p->refine = NULL;
+	}
+	return p;
+    }
+
+    /* Check for a compressed indexed or tiled photo. */
+    if (NULL != (in = pack_fopen (fname))) {
+	if (1 == fread (magic, sizeof (magic), 1, in)) {
+	    if (0 == memcmp (magic, QPHOTO_MAGIC, sizeof (magic))) {
+		p = read_indexed_photo (in);
+		(void)fclose (in);
+		return p;
+	    }
+	    if (0 == memcmp (magic, QPHOTO_TILED_MAGIC, sizeof (magic))) {
+		if (NULL == (p = read_tiled_photo (in))) {
+		    (void)fclose (in);
+		}
+		return p;
+	    }
+	}
+	(void)fclose (in);
+    }
+
+    /* 
+     * Read the pixels, allocate the photo, and fill it in.  If anything
+     * fails, clean up as necessary and return NULL.
+     */
+    if (NULL == (pix = load_image_file (fname, &hdr, MAX_PHOTO_WIDTH,
+					MAX_PHOTO_HEIGHT, sizeof (pix[0]),
+					0, 0)) ||
+	NULL == (p = alloc_photo (&hdr)) ||
+	(0 != refine_later (fname, &pix, p) &&
+	 0 != quantize_cached (fname, pix, p))) {
+	if (NULL != p) {
+	    free (p);
+	}
+	if (NULL != pix) {
+	    free (pix);
+	}
+	return NULL;
+    }
+
+    /* All done.  Return success. */
+    free (pix);
+    return p;
+}
+
+
+/* 
+ * same_photo
+ *   DESCRIPTION: Check whether two room photos have the same contents.
+ *   INPUTS: a, b -- the photos (photo_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the photos match, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+same_photo (const void* a, const void* b)
+{
+    const photo_t* pa = a;	/* first photo  */
+    const photo_t* pb = b;	/* second photo */
+
+    /* The pixels of tiled photos are not in memory to compare. */
+    if (NULL == pa->img || NULL == pb->img) {
+	return 0;
+    }
+    return (pa->hdr.width == pb->hdr.width &&
+	    pa->hdr.height == pb->hdr.height &&
+	    0 == memcmp (pa->palette, pb->palette, sizeof (pa->palette)) &&
+	    0 == memcmp (pa->img, pb->img, pa->hdr.width * pa->hdr.height));
+}
+
+
+/* 
+ * read_photo
+ *   DESCRIPTION: Get a room photo from a file (see load_photo), sharing
+ *                the photo if the same file, or an identical photo, has
+ *                already been read.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the (possibly shared) photo on success, or
+ *                 NULL on failure
+ *   SIDE EFFECTS: may dynamically allocate memory for the photo and 
+ *                 write the photo's cache file; adds a reference to
+ *                 the photo
+ */
+photo_t* 
+read_photo (const char* fname)
+{
+    photo_t* p;		/* new photo    */
+    photo_t* use;	/* photo to use */
+
+    (void)pthread_mutex_lock (&share_lock);
+    use = share_find (shared_photos, fname);
+    (void)pthread_mutex_unlock (&share_lock);
+    if (NULL != use || NULL == (p = load_photo (fname))) {
+	return use;
+    }
+
+    p->share.hash = hash_photo (p);
+    p->share.item = p;
+    if (p != (use = share_add (&shared_photos, &p->share, fname, 
+			       same_photo))) {
+	destroy_photo (p);
+    }
+    return use;
+}
+
+
+/* 
+ * read_photo_header
+ *   DESCRIPTION: Read just the header of a room photo file (or of a
+ *                compressed indexed, tiled, or raw photo), checking that
+ *                the photo is no larger than the limits allow.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: hdr -- the photo header read from the file
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t
+read_photo_header (const char* fname, photo_header_t* hdr)
+{
+    FILE*   in;		/* input file                */
+    int32_t tiled;	/* 1 if photo is tiled       */
+    int32_t rval;	/* return value              */
+
+    if (NULL == (in = pack_fopen (fname))) {
+	return -1;
+    }
+    /* 
+     * The magic sequence of a compressed indexed, tiled, or raw photo is
+     * the size of a photo header, and the real header follows it.  Only
+     * tiled photos may exceed the usual limits.
+     */
+    rval = -1;
+    if (1 == fread (hdr, sizeof (*hdr), 1, in)) {
+	tiled = (0 == memcmp (hdr, QPHOTO_TILED_MAGIC, sizeof (*hdr)));
+	if ((!tiled && 0 != memcmp (hdr, QPHOTO_MAGIC, sizeof (*hdr)) &&
+	     0 != memcmp (hdr, PACK_RAW_PHOTO, sizeof (*hdr))) ||
+	    1 == fread (hdr, sizeof (*hdr), 1, in)) {
+	    rval = ((tiled ? QPHOTO_MAX_TILED_WIDTH : MAX_PHOTO_WIDTH) >= 
+		    hdr->width &&
+		    (tiled ? QPHOTO_MAX_TILED_HEIGHT : MAX_PHOTO_HEIGHT) >= 
+		    hdr->height ? 0 : -1);
+	}
+    }
+    (void)fclose (in);
+    return rval;
+}
+
+
+/* 
+ * free_photo
+ *   DESCRIPTION: Drop a reference to a room photo from read_photo,
+ *                freeing the photo when no references remain.
+ *   INPUTS: p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may free the photo's memory
+ */
+void
+free_photo (photo_t* p)
+{
+    if (share_drop (&shared_photos, &p->share)) {
+	destroy_photo (p);
+    }
+}
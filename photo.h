@@ -52,6 +52,24 @@
 #define MAX_OBJECT_WIDTH  160
 #define MAX_OBJECT_HEIGHT 100
 
+/* 
+ * 1 to keep a column-major copy of the current room as well, so that
+ * vertical lines are copied from consecutive bytes (see fillbench.c);
+ * override with -DCOLUMN_LAYER=0 when compiling
+ */
+#if !defined(COLUMN_LAYER)
+#define COLUMN_LAYER 1
+#endif
+
+/* 
+ * 1 to keep a copy of the current room split into the four mode X planes
+ * as well, so that it is copied into the build buffer a plane row at a
+ * time (see planebench.c); override with -DPLANAR_LAYER=0 when compiling
+ */
+#if !defined(PLANAR_LAYER)
+#define PLANAR_LAYER 1
+#endif
+
 
 /* Fill a buffer with the pixels for a horizontal line of current room. */
 extern void fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM]);
@@ -59,6 +77,21 @@ extern void fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM]);
 /* Fill a buffer with the pixels for a vertical line of current room. */
 extern void fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM]);
 
+/* 
+ * Fill a buffer with the pixels for a w by h rectangle of current room, 
+ * with rows stride bytes apart.
+ */
+extern void fill_rect_buffer (int x, int y, int w, int h, int stride, 
+			      unsigned char* buf);
+
+/* 
+ * Copy a w by h rectangle of current room straight into the four mode X
+ * planes, rows stride bytes apart, if possible.  Returns 0 on success,
+ * or -1 if the rectangle must be filled some other way.
+ */
+extern int fill_planar_buffer (int x, int y, int w, int h, int stride,
+			       unsigned char* planes[4]);
+
 /* Get height of object image in pixels. */
 extern uint32_t image_height (const image_t* im);
 
@@ -71,26 +104,74 @@ extern uint32_t photo_height (const photo_t* p);
 /* Get width of room photo in pixels. */
 extern uint32_t photo_width (const photo_t* p);
 
+/* Get memory taken by room photo pixels (for a tiled photo, its tables). */
+extern uint32_t photo_size (const photo_t* p);
+
 /* 
  * Prepare room for display (record pointer for use by callbacks, set up
  * VGA palette, etc.). 
  */
 extern void prep_room (const room_t* r);
 
-/* Read object image from a file into a dynamically allocated structure. */
+/* 
+ * Note that objects have been added to or removed from a rectangle of a
+ * room's photo, so that the room must be composited again there.
+ */
+extern void room_objects_moved (const room_t* r, int32_t x, int32_t y,
+				int32_t w, int32_t h);
+
+/* Note that a room's photo has been replaced by another. */
+extern void room_photo_swapped (const room_t* r);
+
+/*
+ * Swap in the refined palette and pixels of the current room's photo
+ * once they are ready.  Returns 1 if the room must be redrawn.
+ */
+extern int32_t refine_room (void);
+
+/*
+ * Start the refinement thread, which turns on progressive loading: a
+ * room photo read from a 5:6:5 photo file (and not found in the
+ * quantized photo cache) is returned at once with its pixels mapped to
+ * the 64 object colors, and quantized by the thread afterward.  Only
+ * photos read after the thread starts are affected, so this is of use
+ * only with a photo memory budget (see photo_store.h), under which photos
+ * are read during the game.  Returns 0 on success, or -1 on failure.
+ */
+extern int32_t photo_start_refine (void);
+
+/* Stop the refinement thread if running. */
+extern void photo_stop_refine (void);
+
+/* 
+ * Read object image from a file into a dynamically allocated structure.
+ * Images are shared: reading the same file, or one with the same pixels,
+ * again returns the same image with another reference.
+ */
 extern image_t* read_obj_image (const char* fname);
 
-/* Read room photo from a file into a dynamically allocated structure. */
+/* Drop a reference to an object image read by read_obj_image. */
+extern void free_obj_image (image_t* img);
+
+/* 
+ * Read room photo from a file into a dynamically allocated structure.
+ * Photos are shared in the same way as object images.
+ */
 extern photo_t* read_photo (const char* fname);
 
-int compare(const void  *a, const void *b);
+/* Read just the header of a room photo file.  Returns 0 on success. */
+extern int32_t read_photo_header (const char* fname, photo_header_t* hdr);
+
+/* Drop a reference to a room photo read by read_photo. */
+extern void free_photo (photo_t* p);
 
 /* 
  * N.B.  I'm aware that Valgrind and similar tools will report the fact that
  * I chose not to bother freeing image data before terminating the program.
  * It's probably a bad habit, but ... maybe in a future release (FIXME).
  * (The data are needed until the program terminates, and all data are freed
- * when a program terminates.)
+ * when a program terminates.)  Object images all live in one arena (see
+ * arena.h), so freeing them would take a single call to arena_release.
  */
 
 #endif /* PHOTO_H */
@@ -0,0 +1,282 @@
+/*									tab:8
+ *
+ * photo_cache.c - on-disk cache of quantized room photos
+ *
+ * Filename:	    photo_cache.c
+ * History:
+ *	1	First written.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "photo_cache.h"
+#include "qphoto.h"
+
+
+#define PHOTO_HASH_PRIME 0x00000100000001B3ULL /* 64-bit FNV prime */
+#define MAX_CACHE_PATH   1024	/* longest cache file name accepted */
+
+
+/* directory holding cache files; empty string disables the cache */
+static const char* cache_dir = PHOTO_CACHE_DIR;
+
+/* name of the user's cache directory, set by photo_cache_use_user_dir */
+static char user_dir[MAX_CACHE_PATH];
+
+
+/*
+ * photo_hash
+ *   DESCRIPTION: Hash a block of data with a 64-bit FNV-1a variant that
+ *                folds in eight bytes per step (trailing bytes one at a
+ *                time).  Hashing can be continued across several blocks
+ *                by passing the result of one call as h for the next.
+ *   INPUTS: data -- data to be hashed
+ *           len -- length of data in bytes
+ *           h -- hash so far (PHOTO_HASH_INIT to start)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the updated hash
+ *   SIDE EFFECTS: none
+ */
+uint64_t
+photo_hash (const void* data, size_t len, uint64_t h)
+{
+    const uint8_t* bytes = data; /* next data to be hashed */
+    uint64_t       word;	 /* eight bytes of data    */
+
+    for (; 8 <= len; bytes += 8, len -= 8) {
+	memcpy (&word, bytes, 8);
+	h = (h ^ word) * PHOTO_HASH_PRIME;
+    }
+    for (; 0 < len; bytes++, len--) {
+	h = (h ^ *bytes) * PHOTO_HASH_PRIME;
+    }
+    return h;
+}
+
+
+/*
+ * photo_cache_set_dir
+ *   DESCRIPTION: Set the directory used for cache files.
+ *   INPUTS: dir -- directory name, or "" to disable the cache
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the string is referenced (not copied) by later calls
+ */
+void
+photo_cache_set_dir (const char* dir)
+{
+    cache_dir = dir;
+}
+
+
+/*
+ * photo_cache_use_user_dir
+ *   DESCRIPTION: Set the directory used for cache files to
+ *                PHOTO_CACHE_NAME in the user's cache directory, which
+ *                is $XDG_CACHE_HOME if that is an absolute path, or else
+ *                $HOME/.cache.  If neither is available, or the name is
+ *                too long, the cache is disabled.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: not thread-safe; must be called before photos are
+ *                 loaded
+ */
+void
+photo_cache_use_user_dir ()
+{
+    const char* base;	/* user's cache directory, or home directory */
+    const char* sub;	/* cache directory within base               */
+    int         len;	/* length of cache directory name            */
+
+    if (NULL != (base = getenv ("XDG_CACHE_HOME")) && '/' == base[0]) {
+	sub = "";
+    } else if (NULL != (base = getenv ("HOME")) && '/' == base[0]) {
+	sub = "/.cache";
+    } else {
+	cache_dir = "";
+	return;
+    }
+    len = snprintf (user_dir, sizeof (user_dir), "%s%s/%s", base, sub,
+		    PHOTO_CACHE_NAME);
+    cache_dir = (0 < len && sizeof (user_dir) > (size_t)len ? user_dir : "");
+}
+
+
+/*
+ * make_cache_dir
+ *   DESCRIPTION: Create the cache directory, and its parent if that is
+ *                missing too (as $HOME/.cache may be).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the directory exists, or -1 on failure
+ *   SIDE EFFECTS: may create directories
+ */
+static int32_t
+make_cache_dir ()
+{
+    char  parent[MAX_CACHE_PATH]; /* name of parent directory */
+    char* slash;		  /* last '/' in parent      */
+
+    if (0 == mkdir (cache_dir, 0777) || EEXIST == errno) {
+	return 0;
+    }
+    if (ENOENT != errno || sizeof (parent) <= strlen (cache_dir)) {
+	return -1;
+    }
+    (void)strcpy (parent, cache_dir);
+    if (NULL == (slash = strrchr (parent, '/')) || parent == slash) {
+	return -1;
+    }
+    *slash = '\0';
+    if ((0 != mkdir (parent, 0777) && EEXIST != errno) ||
+	(0 != mkdir (cache_dir, 0777) && EEXIST != errno)) {
+	return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * cache_path
+ *   DESCRIPTION: Build the name of the cache file for a photo file.
+ *   INPUTS: fname -- photo file name
+ *   OUTPUTS: path -- cache file name
+ *   RETURN VALUE: 0 on success, or -1 if the cache is disabled or the
+ *                 name is too long
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+cache_path (const char* fname, char path[MAX_CACHE_PATH])
+{
+    int   len;	/* length of cache file name */
+    char* s;	/* loop index over name      */
+
+    if ('\0' == cache_dir[0]) {
+	return -1;
+    }
+    len = snprintf (path, MAX_CACHE_PATH, "%s/%s.qc", cache_dir, fname);
+    if (0 > len || MAX_CACHE_PATH <= len) {
+	return -1;
+    }
+
+    /* Flatten the photo file name into a single directory entry. */
+    for (s = path + strlen (cache_dir) + 1; '\0' != *s; s++) {
+	if ('/' == *s) {
+	    *s = '_';
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * photo_cache_load
+ *   DESCRIPTION: Fill in a photo's palette and pixels from its cache file,
+ *                provided that the file was written for the same photo
+ *                contents, quantizer, and cache format.
+ *   INPUTS: fname -- photo file name
+ *           hash -- photo_hash of the photo file contents
+ *           hdr -- photo dimensions
+ *   OUTPUTS: palette -- the cached palette
+ *            img -- the cached pixels (width * height VGA colors)
+ *   RETURN VALUE: 0 on success, or -1 if no matching cache file exists
+ *   SIDE EFFECTS: may overwrite img even on failure
+ */
+int32_t
+photo_cache_load (const char* fname, uint64_t hash, const photo_header_t* hdr,
+		  uint8_t palette[QUANT_COLORS][3], uint8_t* img)
+{
+    char                 path[MAX_CACHE_PATH]; /* cache file name       */
+    FILE*                in;	/* input file stream                     */
+    photo_cache_header_t ch;	/* cache file header                     */
+    int32_t              rval;	/* return value                          */
+
+    if (0 != cache_path (fname, path) || NULL == (in = fopen (path, "rb"))) {
+	return -1;
+    }
+
+    /*
+     * Check the header against what we expect, then decode the pixels,
+     * which must run exactly to the end of the file.
+     */
+    rval = -1;
+    if (1 == fread (&ch, sizeof (ch), 1, in) &&
+	0 == memcmp (ch.magic, PHOTO_CACHE_MAGIC, sizeof (ch.magic)) &&
+	PHOTO_CACHE_VERSION == ch.version &&
+	hash == ch.source_hash &&
+	quantize_get_method () == ch.method &&
+	quantize_method_version (ch.method) == ch.method_version &&
+	hdr->width == ch.hdr.width && hdr->height == ch.hdr.height &&
+	0 == qphoto_read_rows (in, img, hdr->width, hdr->height) &&
+	EOF == fgetc (in)) {
+	memcpy (palette, ch.palette, sizeof (ch.palette));
+	rval = 0;
+    }
+    (void)fclose (in);
+    return rval;
+}
+
+
+/*
+ * photo_cache_store
+ *   DESCRIPTION: Write a photo's palette and pixels to its cache file.
+ *                The data are written to a temporary file that is then
+ *                renamed, so that other loaders never see a partial file.
+ *   INPUTS: fname -- photo file name
+ *           hash -- photo_hash of the photo file contents
+ *           hdr -- photo dimensions
+ *           palette -- the photo's palette
+ *           img -- the photo's pixels (width * height VGA colors)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: creates the cache directory if necessary; replaces
+ *                 the cache file; failures leave the cache unchanged
+ */
+void
+photo_cache_store (const char* fname, uint64_t hash, const photo_header_t* hdr,
+		   uint8_t palette[QUANT_COLORS][3], const uint8_t* img)
+{
+    char                 path[MAX_CACHE_PATH]; /* cache file name       */
+    char                 tmp[MAX_CACHE_PATH + 8]; /* temporary file name */
+    int                  fd;	/* temporary file descriptor             */
+    FILE*                out;	/* output file stream                    */
+    photo_cache_header_t ch;	/* cache file header                     */
+    int32_t              ok;	/* 1 if file written successfully        */
+
+    if (0 != cache_path (fname, path) || 0 != make_cache_dir ()) {
+	return;
+    }
+    (void)snprintf (tmp, sizeof (tmp), "%s.XXXXXX", path);
+    if (-1 == (fd = mkstemp (tmp))) {
+	return;
+    }
+    if (NULL == (out = fdopen (fd, "wb"))) {
+	(void)close (fd);
+	(void)unlink (tmp);
+	return;
+    }
+
+    /* Zero the header first so that no stray padding bytes are written. */
+    memset (&ch, 0, sizeof (ch));
+    memcpy (ch.magic, PHOTO_CACHE_MAGIC, sizeof (ch.magic));
+    ch.version = PHOTO_CACHE_VERSION;
+    ch.source_hash = hash;
+    ch.method = quantize_get_method ();
+    ch.method_version = quantize_method_version (ch.method);
+    ch.hdr = *hdr;
+    memcpy (ch.palette, palette, sizeof (ch.palette));
+
+    ok = (1 == fwrite (&ch, sizeof (ch), 1, out) &&
+	  0 == qphoto_write_rows (out, img, hdr->width, hdr->height));
+    if (0 != fclose (out) || !ok || 0 != rename (tmp, path)) {
+	(void)unlink (tmp);
+    }
+}
@@ -0,0 +1,94 @@
+/*									tab:8
+ *
+ * photo_cache.h - on-disk cache of quantized room photos, header file
+ *
+ * Filename:	    photo_cache.h
+ * History:
+ *	1	First written.
+ */
+#ifndef PHOTO_CACHE_H
+#define PHOTO_CACHE_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "photo_headers.h"
+#include "quantize.h"
+
+
+/*
+ * Quantizing a room photo is the bulk of the work of loading it, and the
+ * result depends only on the photo file and the quantizer.  We keep the
+ * palette and VGA color pixels of each quantized photo in a cache file,
+ * tagged with a hash of the photo file contents and the quantizer used,
+ * along with that quantizer's version (see quantize_method_version).
+ * When all match, the cached pixels are used as is; otherwise the photo
+ * is quantized again and the cache file rewritten.
+ *
+ * Cache files live in one directory, named after the photo file with
+ * each '/' replaced by '_' and ".qc" appended.  A cache file holds a
+ * photo_cache_header_t followed by the photo's VGA colors as compressed
+ * rows (see qphoto.h), top row first.  Problems with the cache are never
+ * fatal: the photo is simply quantized as if no cache existed.
+ */
+#define PHOTO_CACHE_MAGIC   "QPC1"	/* cache file magic sequence     */
+#define PHOTO_CACHE_VERSION 3		/* bump when layout changes      */
+#define PHOTO_HASH_INIT     0xCBF29CE484222325ULL /* hash seed           */
+
+/*
+ * Cache directory used until another is set; empty (the default) to
+ * disable caching.  The game itself keeps its cache in the user's cache
+ * directory, under PHOTO_CACHE_NAME (see photo_cache_use_user_dir).
+ */
+#if !defined(PHOTO_CACHE_DIR)
+#define PHOTO_CACHE_DIR ""
+#endif
+#define PHOTO_CACHE_NAME "adventure"
+
+typedef struct photo_cache_header_t photo_cache_header_t;
+struct photo_cache_header_t {
+    char           magic[4];	/* PHOTO_CACHE_MAGIC (not terminated)  */
+    uint32_t       version;	/* PHOTO_CACHE_VERSION                 */
+    uint64_t       source_hash;	/* photo_hash of photo file contents   */
+    uint32_t       method;	/* quant_method_t used                 */
+    uint32_t       method_version; /* quantize_method_version of it     */
+    photo_header_t hdr;		/* photo dimensions                    */
+    uint8_t        palette[QUANT_COLORS][3]; /* palette (6-bit RGB)    */
+};
+
+/* Hash len bytes at data, continuing from hash h (start with PHOTO_HASH_INIT). */
+extern uint64_t photo_hash (const void* data, size_t len, uint64_t h);
+
+/*
+ * Set the cache directory (created if necessary when first written).
+ * An empty string disables the cache.  The string is not copied.
+ */
+extern void photo_cache_set_dir (const char* dir);
+
+/*
+ * Set the cache directory to PHOTO_CACHE_NAME in the user's cache
+ * directory: $XDG_CACHE_HOME if set, or else $HOME/.cache.  Disables the
+ * cache if neither is available.  Not thread-safe; call before loading
+ * photos.
+ */
+extern void photo_cache_use_user_dir ();
+
+/*
+ * Look up the quantized form of photo file fname.  Succeeds only if the
+ * cache file matches hash, the current quantizer and its version, and
+ * the dimensions in hdr.  Returns 0 and fills in palette and img on
+ * success, or returns -1.
+ */
+extern int32_t photo_cache_load (const char* fname, uint64_t hash,
+				 const photo_header_t* hdr,
+				 uint8_t palette[QUANT_COLORS][3],
+				 uint8_t* img);
+
+/* Record the quantized form of photo file fname (errors are ignored). */
+extern void photo_cache_store (const char* fname, uint64_t hash,
+			       const photo_header_t* hdr,
+			       uint8_t palette[QUANT_COLORS][3],
+			       const uint8_t* img);
+
+#endif /* PHOTO_CACHE_H */
@@ -0,0 +1,483 @@
+/*									tab:8
+ *
+ * photo_store.c - room photo residency under a memory budget
+ *
+ * Filename:	    photo_store.c
+ * History:
+ *	1	First written.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "photo.h"
+#include "photo_headers.h"
+#include "photo_store.h"
+
+
+#define MAX_PREFETCH 8	/* most prefetch requests outstanding at once */
+
+
+/* types local to this file (declared in types.h) */
+
+/* a room photo, possibly resident in memory */
+struct photo_slot_t {
+    const char*    fname;	/* photo file name                     */
+    photo_header_t hdr;		/* photo dimensions                    */
+    photo_t*       photo;	/* the photo, or NULL if not resident  */
+    int32_t        loading;	/* 1 while a thread is reading photo   */
+    uint32_t       last_use;	/* use_clock value at last use         */
+    photo_slot_t*  next;	/* next in list of all slots           */
+};
+
+
+/* file-scope variables */
+
+/* 
+ * All of the variables below, as well as the photo, loading, and last_use
+ * fields of every slot, are protected by store_lock.  Threads waiting for
+ * another thread to finish reading a photo wait on store_loaded.
+ */
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  store_loaded = PTHREAD_COND_INITIALIZER;
+static photo_slot_t*   all_slots = NULL;    /* list of all slots          */
+static photo_slot_t*   in_view = NULL;	    /* slot with photo in view    */
+static uint32_t        use_clock = 0;	    /* count of slot uses         */
+static uint32_t        resident_bytes = 0;  /* pixels of resident photos  */
+static uint32_t        reserved_bytes = 0;  /* other memory in budget     */
+static uint32_t        budget = PHOTO_BUDGET; /* limit on the two         */
+
+/* 
+ * Prefetch requests, also protected by store_lock; the prefetch thread 
+ * waits on prefetch_cv for requests or to be stopped.
+ */
+static pthread_cond_t  prefetch_cv = PTHREAD_COND_INITIALIZER;
+static pthread_t       prefetch_tid;		/* prefetch thread id     */
+static int32_t         prefetch_running = 0;	/* 1 if thread started    */
+static photo_slot_t*   prefetch_queue[MAX_PREFETCH]; /* slots to read     */
+static int32_t         n_prefetch = 0;		/* slots in queue         */
+
+
+/*
+ * photo_store_set_budget
+ *   DESCRIPTION: Set the budget for resident room photo pixels.
+ *   INPUTS: bytes -- the budget in bytes, or 0 for no limit
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: takes effect the next time a photo is read
+ */
+void
+photo_store_set_budget (uint32_t bytes)
+{
+    (void)pthread_mutex_lock (&store_lock);
+    budget = bytes;
+    (void)pthread_mutex_unlock (&store_lock);
+}
+
+
+/*
+ * photo_store_budget
+ *   DESCRIPTION: Get the budget for resident room photo pixels.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the budget in bytes, or 0 for no limit
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+photo_store_budget ()
+{
+    return budget;
+}
+
+
+/*
+ * find_slot
+ *   DESCRIPTION: Find the slot for a photo file.  Must be called with
+ *                store_lock held.
+ *   INPUTS: fname -- photo file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot, or NULL if the file has none
+ *   SIDE EFFECTS: none
+ */
+static photo_slot_t*
+find_slot (const char* fname)
+{
+    photo_slot_t* s;	/* loop index over slots */
+
+    for (s = all_slots; NULL != s; s = s->next) {
+	if (0 == strcmp (s->fname, fname)) {
+	    return s;
+	}
+    }
+    return NULL;
+}
+
+
+/*
+ * photo_slot_create
+ *   DESCRIPTION: Create a slot for a room photo, reading only the header
+ *                of the photo file.  Rooms that show the same file share
+ *                a slot, so the photo is read and counted only once.
+ *   INPUTS: fname -- photo file name (not copied)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot, or NULL on failure
+ *   SIDE EFFECTS: dynamically allocates memory for a new slot
+ */
+photo_slot_t*
+photo_slot_create (const char* fname)
+{
+    photo_slot_t* s;	/* the new slot      */
+    photo_slot_t* t;	/* the existing slot */
+
+    (void)pthread_mutex_lock (&store_lock);
+    t = find_slot (fname);
+    (void)pthread_mutex_unlock (&store_lock);
+    if (NULL != t) {
+	return t;
+    }
+
+    if (NULL == (s = malloc (sizeof (*s)))) {
+	return NULL;
+    }
+    if (0 != read_photo_header (fname, &s->hdr)) {
+	free (s);
+	return NULL;
+    }
+    s->fname = fname;
+    s->photo = NULL;
+    s->loading = 0;
+    s->last_use = 0;
+
+    /* Another thread may have created a slot for the file meanwhile. */
+    (void)pthread_mutex_lock (&store_lock);
+    if (NULL == (t = find_slot (fname))) {
+	s->next = all_slots;
+	all_slots = s;
+	t = s;
+    }
+    (void)pthread_mutex_unlock (&store_lock);
+    if (s != t) {
+	free (s);
+    }
+
+    return t;
+}
+
+
+/*
+ * photo_slot_filename
+ *   DESCRIPTION: Get the file name of a slot's photo.
+ *   INPUTS: s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: the file name
+ *   SIDE EFFECTS: none
+ */
+const char*
+photo_slot_filename (const photo_slot_t* s)
+{
+    return s->fname;
+}
+
+
+/*
+ * photo_slot_height
+ *   DESCRIPTION: Get the height of a slot's photo.
+ *   INPUTS: s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: height of photo in pixels
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+photo_slot_height (const photo_slot_t* s)
+{
+    return s->hdr.height;
+}
+
+
+/*
+ * photo_slot_width
+ *   DESCRIPTION: Get the width of a slot's photo.
+ *   INPUTS: s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: width of photo in pixels
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+photo_slot_width (const photo_slot_t* s)
+{
+    return s->hdr.width;
+}
+
+
+/*
+ * evict_over_budget
+ *   DESCRIPTION: Free least recently used photos until the resident
+ *                photos and the reservation (see photo_store_reserve)
+ *                fit in the budget (or no more can be freed).
+ *                Neither the photo in view nor keep is freed.  Must be
+ *                called with store_lock held.
+ *   INPUTS: keep -- a slot whose photo must stay resident
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees photos
+ */
+static void
+evict_over_budget (const photo_slot_t* keep)
+{
+    photo_slot_t* s;	/* loop index over slots    */
+    photo_slot_t* lru;	/* least recently used slot */
+
+    while (0 != budget && budget < resident_bytes + reserved_bytes) {
+	lru = NULL;
+	for (s = all_slots; NULL != s; s = s->next) {
+	    if (NULL != s->photo && keep != s && in_view != s &&
+		(NULL == lru || lru->last_use > s->last_use)) {
+		lru = s;
+	    }
+	}
+	if (NULL == lru) {
+	    return;
+	}
+	resident_bytes -= photo_size (lru->photo);
+	free_photo (lru->photo);
+	lru->photo = NULL;
+    }
+}
+
+
+/*
+ * photo_store_reserve
+ *   DESCRIPTION: Reserve part of the budget for memory other than photo
+ *                pixels, such as the composited room layer, replacing
+ *                any earlier reservation.  Photos out of view are freed
+ *                to make room.
+ *   INPUTS: bytes -- the amount to reserve
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the reservation fits in the budget (always with
+ *                 no budget), or -1 if it does not, in which case the
+ *                 reservation is dropped
+ *   SIDE EFFECTS: may free photos
+ */
+int32_t
+photo_store_reserve (uint32_t bytes)
+{
+    int32_t rval = 0;	/* return value */
+
+    (void)pthread_mutex_lock (&store_lock);
+    reserved_bytes = bytes;
+    evict_over_budget (NULL);
+    if (0 != budget && budget < resident_bytes + reserved_bytes) {
+	reserved_bytes = 0;
+	rval = -1;
+    }
+    (void)pthread_mutex_unlock (&store_lock);
+    return rval;
+}
+
+
+/*
+ * make_resident
+ *   DESCRIPTION: Make a slot's photo resident, reading it if necessary,
+ *                and mark it as just used.  Must be called with 
+ *                store_lock held; the lock is dropped while reading.
+ *   INPUTS: s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if the photo can't be read
+ *   SIDE EFFECTS: may read the photo and free others
+ */
+static int32_t
+make_resident (photo_slot_t* s)
+{
+    photo_t* p;	/* photo read */
+
+    /* Wait for any other thread already reading this photo. */
+    while (s->loading) {
+	(void)pthread_cond_wait (&store_loaded, &store_lock);
+    }
+    s->last_use = ++use_clock;
+    if (NULL != s->photo) {
+	return 0;
+    }
+
+    /* Read the photo without holding the lock. */
+    s->loading = 1;
+    (void)pthread_mutex_unlock (&store_lock);
+    p = read_photo (s->fname);
+    (void)pthread_mutex_lock (&store_lock);
+    s->loading = 0;
+    (void)pthread_cond_broadcast (&store_loaded);
+    if (NULL == p) {
+	return -1;
+    }
+
+    s->photo = p;
+    resident_bytes += photo_size (p);
+    evict_over_budget (s);
+    return 0;
+}
+
+
+/*
+ * photo_slot_load
+ *   DESCRIPTION: Make a slot's photo resident without bringing it into
+ *                view.
+ *   INPUTS: s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if the photo can't be read
+ *   SIDE EFFECTS: may read the photo and free others
+ */
+int32_t
+photo_slot_load (photo_slot_t* s)
+{
+    int32_t rval;	/* return value */
+
+    (void)pthread_mutex_lock (&store_lock);
+    rval = make_resident (s);
+    (void)pthread_mutex_unlock (&store_lock);
+    return rval;
+}
+
+
+/*
+ * photo_slot_get
+ *   DESCRIPTION: Bring a slot's photo into view, making it resident if
+ *                necessary.
+ *   INPUTS: s -- the slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: the photo, or NULL if the photo can't be read
+ *   SIDE EFFECTS: may read the photo and free others, including the
+ *                 photo previously in view
+ */
+photo_t*
+photo_slot_get (photo_slot_t* s)
+{
+    photo_t* p = NULL;	/* photo in view */
+
+    (void)pthread_mutex_lock (&store_lock);
+    if (0 == make_resident (s)) {
+	p = s->photo;
+	if (in_view != s) {
+	    in_view = s;
+	    evict_over_budget (s);
+	}
+    }
+    (void)pthread_mutex_unlock (&store_lock);
+    return p;
+}
+
+
+/*
+ * prefetch_thread
+ *   DESCRIPTION: Make the photos of requested slots resident, one at a
+ *                time, until told to stop.
+ *   INPUTS: arg -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: reads photos and frees others
+ */
+static void*
+prefetch_thread (void* arg)
+{
+    photo_slot_t* s;	/* slot being read */
+
+    (void)pthread_mutex_lock (&store_lock);
+    while (1) {
+	while (prefetch_running && 0 == n_prefetch) {
+	    (void)pthread_cond_wait (&prefetch_cv, &store_lock);
+	}
+	if (!prefetch_running) {
+	    break;
+	}
+	s = prefetch_queue[0];
+	memmove (prefetch_queue, prefetch_queue + 1,
+		 --n_prefetch * sizeof (prefetch_queue[0]));
+
+	/* Failures are ignored here; they show up when the photo is used. */
+	(void)make_resident (s);
+    }
+    (void)pthread_mutex_unlock (&store_lock);
+    return NULL;
+}
+
+
+/*
+ * photo_store_start_prefetch
+ *   DESCRIPTION: Start the prefetch thread.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: creates a thread
+ */
+int32_t
+photo_store_start_prefetch ()
+{
+    (void)pthread_mutex_lock (&store_lock);
+    prefetch_running = 1;
+    n_prefetch = 0;
+    (void)pthread_mutex_unlock (&store_lock);
+    if (0 != pthread_create (&prefetch_tid, NULL, prefetch_thread, NULL)) {
+	(void)pthread_mutex_lock (&store_lock);
+	prefetch_running = 0;
+	(void)pthread_mutex_unlock (&store_lock);
+	return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * photo_store_stop_prefetch
+ *   DESCRIPTION: Stop the prefetch thread, discarding any requests it
+ *                has not yet handled.  Does nothing if the thread is
+ *                not running.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: waits for the prefetch thread to finish
+ */
+void
+photo_store_stop_prefetch ()
+{
+    int32_t was_running;	/* 1 if thread had been started */
+
+    (void)pthread_mutex_lock (&store_lock);
+    was_running = prefetch_running;
+    prefetch_running = 0;
+    n_prefetch = 0;
+    (void)pthread_cond_signal (&prefetch_cv);
+    (void)pthread_mutex_unlock (&store_lock);
+    if (was_running) {
+	(void)pthread_join (prefetch_tid, NULL);
+    }
+}
+
+
+/*
+ * photo_store_prefetch
+ *   DESCRIPTION: Replace the prefetch requests with a new list of slots.
+ *                Slots already resident (or being read) are skipped.
+ *   INPUTS: slots -- the slots, most wanted first
+ *           n -- number of slots
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: wakes the prefetch thread
+ */
+void
+photo_store_prefetch (photo_slot_t* const* slots, int32_t n)
+{
+    int32_t idx;	/* index over slots */
+
+    (void)pthread_mutex_lock (&store_lock);
+    if (prefetch_running) {
+	n_prefetch = 0;
+	for (idx = 0; n > idx && MAX_PREFETCH > n_prefetch; idx++) {
+	    if (NULL == slots[idx]->photo && !slots[idx]->loading) {
+		prefetch_queue[n_prefetch++] = slots[idx];
+	    }
+	}
+	(void)pthread_cond_signal (&prefetch_cv);
+    }
+    (void)pthread_mutex_unlock (&store_lock);
+}
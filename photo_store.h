@@ -0,0 +1,101 @@
+/*									tab:8
+ *
+ * photo_store.h - room photo residency under a memory budget, header file
+ *
+ * Filename:	    photo_store.h
+ * History:
+ *	1	First written.
+ */
+#ifndef PHOTO_STORE_H
+#define PHOTO_STORE_H
+
+
+#include <stdint.h>
+
+#include "types.h"
+
+
+/*
+ * Each room photo (including the swap photos) is held in a slot, which
+ * knows the photo's file name and dimensions and holds the photo itself
+ * only while it is resident.  Photos are read when first needed.  Once
+ * the pixels of resident photos take up more than the budget, the least
+ * recently used photos are freed, except for the one in view (the one
+ * most recently returned by photo_slot_get), which stays resident until
+ * another photo is brought into view.  Memory kept for drawing the photo
+ * in view (the composited room layer) can be reserved from the budget
+ * too.  With a budget of zero, nothing is ever freed.  Slots may be used
+ * from several threads at once.
+ *
+ * Photos likely to be needed soon can also be read ahead of time by a
+ * background prefetch thread, so that bringing them into view later
+ * does not wait for the disk or the quantizer.
+ */
+
+/* 
+ * default budget in bytes of room photo pixels (0 for no limit); 
+ * override with -DPHOTO_BUDGET=n when compiling, or at run time
+ */
+#if !defined(PHOTO_BUDGET)
+#define PHOTO_BUDGET 0
+#endif
+
+/* Set the budget in bytes of room photo pixels (0 for no limit). */
+extern void photo_store_set_budget (uint32_t bytes);
+
+/* Get the budget in bytes of room photo pixels (0 for no limit). */
+extern uint32_t photo_store_budget (void);
+
+/*
+ * Reserve bytes of the budget for memory other than photo pixels, in
+ * place of any earlier reservation, freeing photos out of view to make
+ * room.  Returns 0 if the reservation fits (always, with no budget), or
+ * -1 if it does not, in which case nothing stays reserved.
+ */
+extern int32_t photo_store_reserve (uint32_t bytes);
+
+/* 
+ * Create a slot for a room photo file, reading only its header, or get
+ * the existing slot for the file.  The file name is not copied.  Returns
+ * NULL on failure.
+ */
+extern photo_slot_t* photo_slot_create (const char* fname);
+
+/* Get the file name of a slot's photo. */
+extern const char* photo_slot_filename (const photo_slot_t* s);
+
+/* Get height of a slot's photo in pixels (the photo need not be resident). */
+extern uint32_t photo_slot_height (const photo_slot_t* s);
+
+/* Get width of a slot's photo in pixels (the photo need not be resident). */
+extern uint32_t photo_slot_width (const photo_slot_t* s);
+
+/*
+ * Make a slot's photo resident, reading it if necessary, without bringing
+ * it into view.  Returns 0 on success, or -1 if the photo can't be read.
+ */
+extern int32_t photo_slot_load (photo_slot_t* s);
+
+/*
+ * Bring a slot's photo into view, reading it if necessary.  The photo
+ * returned stays valid until another slot's photo is brought into view.
+ * Returns NULL if the photo can't be read.
+ */
+extern photo_t* photo_slot_get (photo_slot_t* s);
+
+/* 
+ * Start the prefetch thread.  Returns 0 on success, or -1 on failure.
+ * Until it is started, photo_store_prefetch does nothing.
+ */
+extern int32_t photo_store_start_prefetch (void);
+
+/* Stop the prefetch thread if running (waits for any photo being read). */
+extern void photo_store_stop_prefetch (void);
+
+/*
+ * Ask the prefetch thread to make the photos of n slots resident, in
+ * order, in place of any earlier requests it has not yet handled.
+ */
+extern void photo_store_prefetch (photo_slot_t* const* slots, int32_t n);
+
+#endif /* PHOTO_STORE_H */
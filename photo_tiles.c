@@ -0,0 +1,359 @@
+/*									tab:8
+ *
+ * photo_tiles.c - on-demand tiles of tiled room photos
+ *
+ * Filename:	    photo_tiles.c
+ * History:
+ *	1	First written.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "photo_tiles.h"
+#include "qphoto.h"
+
+
+/* types local to this file (declared in photo_tiles.h) */
+
+/* a tiled photo */
+struct photo_tiles_t {
+    FILE*          in;		/* photo file                         */
+    photo_header_t hdr;		/* photo dimensions                   */
+    uint32_t       tiles_x;	/* tiles across photo                 */
+    uint32_t       n_tiles;	/* tiles in photo                     */
+    uint32_t*      index;	/* file position of each tile, then   */
+				/*   of the end of the last tile      */
+    int16_t*       slot;	/* cache slot holding each tile, or   */
+				/*   -1 if tile is not in the cache   */
+};
+
+/* a slot in the tile cache */
+typedef struct tile_slot_t tile_slot_t;
+struct tile_slot_t {
+    photo_tiles_t* owner;	/* photo of tile held, or NULL if free */
+    uint32_t       tx;		/* tile column of tile held            */
+    uint32_t       ty;		/* tile row of tile held               */
+    uint8_t        pix[QPHOTO_TILE_SIZE * QPHOTO_TILE_SIZE]; /* pixels */
+};
+
+
+/* file-scope variables */
+
+/*
+ * The tile cache, shared by all tiled photos.  The cache, the slot
+ * tables of all photos, and photo file streams are protected by
+ * tile_lock, since photos may be opened and closed by other threads
+ * while the screen is being drawn.
+ */
+static pthread_mutex_t tile_lock = PTHREAD_MUTEX_INITIALIZER;
+static tile_slot_t     cache[PHOTO_TILE_CACHE];
+
+
+/*
+ * photo_tiles_open
+ *   DESCRIPTION: Read the tile index of a tiled photo and set up its
+ *                table of cached tiles.
+ *   INPUTS: in -- photo file stream, positioned at the tile index
+ *           hdr -- photo dimensions
+ *   OUTPUTS: none
+ *   RETURN VALUE: the tiled photo, or NULL on failure
+ *   SIDE EFFECTS: dynamically allocates memory; on success, the tiled
+ *                 photo takes over the stream
+ */
+photo_tiles_t*
+photo_tiles_open (FILE* in, const photo_header_t* hdr)
+{
+    photo_tiles_t* t;	/* the tiled photo  */
+    uint32_t       i;	/* index over tiles */
+
+    if (NULL == (t = malloc (sizeof (*t)))) {
+	return NULL;
+    }
+    t->in = in;
+    t->hdr = *hdr;
+    t->tiles_x = QPHOTO_TILES (hdr->width);
+    t->n_tiles = t->tiles_x * QPHOTO_TILES (hdr->height);
+    t->slot = NULL;
+
+    /*
+     * Read the index and check that tiles follow one another, then mark
+     * all tiles as not cached.  If anything fails, clean up as necessary
+     * and return NULL.
+     */
+    if (NULL == (t->index = malloc ((t->n_tiles + 1) * 
+				    sizeof (t->index[0]))) ||
+	t->n_tiles + 1 != fread (t->index, sizeof (t->index[0]),
+				 t->n_tiles + 1, in) ||
+	NULL == (t->slot = malloc (t->n_tiles * sizeof (t->slot[0])))) {
+	free (t->index);
+	free (t->slot);
+	free (t);
+	return NULL;
+    }
+    for (i = 0; t->n_tiles > i; i++) {
+	if (t->index[i] > t->index[i + 1]) {
+	    free (t->index);
+	    free (t->slot);
+	    free (t);
+	    return NULL;
+	}
+	t->slot[i] = -1;
+    }
+    return t;
+}
+
+
+/*
+ * photo_tiles_close
+ *   DESCRIPTION: Close a tiled photo.
+ *   INPUTS: t -- the tiled photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the photo's cache slots, closes its file, and
+ *                 frees its memory
+ */
+void
+photo_tiles_close (photo_tiles_t* t)
+{
+    int32_t i;	/* index over cache slots */
+
+    (void)pthread_mutex_lock (&tile_lock);
+    for (i = 0; PHOTO_TILE_CACHE > i; i++) {
+	if (t == cache[i].owner) {
+	    cache[i].owner = NULL;
+	}
+    }
+    (void)pthread_mutex_unlock (&tile_lock);
+    (void)fclose (t->in);
+    free (t->index);
+    free (t->slot);
+    free (t);
+}
+
+
+/*
+ * photo_tiles_size
+ *   DESCRIPTION: Get the memory used by a tiled photo, not counting the
+ *                tile cache.
+ *   INPUTS: t -- the tiled photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: size in bytes
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+photo_tiles_size (const photo_tiles_t* t)
+{
+    return (sizeof (*t) + (t->n_tiles + 1) * sizeof (t->index[0]) +
+	    t->n_tiles * sizeof (t->slot[0]));
+}
+
+
+/*
+ * choose_slot
+ *   DESCRIPTION: Choose the cache slot to hold a new tile: a free slot,
+ *                or else one holding a tile of another photo, or else
+ *                the one holding the tile farthest from the new one.
+ *                Must be called with tile_lock held.
+ *   INPUTS: t -- the tiled photo
+ *           (tx,ty) -- tile column and row of the new tile
+ *   OUTPUTS: none
+ *   RETURN VALUE: index of the slot
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+choose_slot (const photo_tiles_t* t, uint32_t tx, uint32_t ty)
+{
+    int32_t  i;		/* index over cache slots      */
+    int32_t  far;	/* slot with farthest tile     */
+    uint32_t dist;	/* distance of tile in slot i  */
+    uint32_t far_dist;	/* distance of farthest tile   */
+    uint32_t dy;	/* rows of tiles between tiles */
+
+    far = 0;
+    far_dist = 0;
+    for (i = 0; PHOTO_TILE_CACHE > i; i++) {
+	if (t != cache[i].owner) {
+	    return i;
+	}
+	dist = (tx > cache[i].tx ? tx - cache[i].tx : cache[i].tx - tx);
+	dy = (ty > cache[i].ty ? ty - cache[i].ty : cache[i].ty - ty);
+	if (dist < dy) {
+	    dist = dy;
+	}
+	if (far_dist < dist) {
+	    far = i;
+	    far_dist = dist;
+	}
+    }
+    return far;
+}
+
+
+/*
+ * get_tile
+ *   DESCRIPTION: Get the pixels of a tile, reading the tile into the
+ *                cache if necessary.  Must be called with tile_lock held.
+ *   INPUTS: t -- the tiled photo
+ *           (tx,ty) -- tile column and row
+ *   OUTPUTS: none
+ *   RETURN VALUE: the tile's pixels, in rows of QPHOTO_TILE_SIZE bytes,
+ *                 or NULL if the tile can't be read
+ *   SIDE EFFECTS: may drop another tile from the cache
+ */
+static const uint8_t*
+get_tile (photo_tiles_t* t, uint32_t tx, uint32_t ty)
+{
+    uint32_t       idx = ty * t->tiles_x + tx; /* tile number     */
+    int32_t        i;	/* cache slot for tile                   */
+    tile_slot_t*   s;	/* the cache slot                        */
+    photo_tiles_t* o;	/* photo of tile dropped from the slot   */
+    uint32_t       w;	/* tile width                            */
+    uint32_t       h;	/* tile height                           */
+
+    if (0 <= t->slot[idx]) {
+	return cache[t->slot[idx]].pix;
+    }
+
+    /* Drop the tile held by the chosen slot, if any. */
+    s = &cache[i = choose_slot (t, tx, ty)];
+    if (NULL != (o = s->owner)) {
+	o->slot[s->ty * o->tiles_x + s->tx] = -1;
+	s->owner = NULL;
+    }
+
+    /* Tiles at the right and bottom edges may be smaller. */
+    w = t->hdr.width - tx * QPHOTO_TILE_SIZE;
+    if (QPHOTO_TILE_SIZE < w) {
+	w = QPHOTO_TILE_SIZE;
+    }
+    h = t->hdr.height - ty * QPHOTO_TILE_SIZE;
+    if (QPHOTO_TILE_SIZE < h) {
+	h = QPHOTO_TILE_SIZE;
+    }
+    if (0 != fseek (t->in, t->index[idx], SEEK_SET) ||
+	0 != qphoto_read_tile (t->in, s->pix, w, h)) {
+	return NULL;
+    }
+    s->owner = t;
+    s->tx = tx;
+    s->ty = ty;
+    t->slot[idx] = i;
+    return s->pix;
+}
+
+
+/*
+ * photo_tiles_fill_row
+ *   DESCRIPTION: Fill a buffer with the pixels of a horizontal line of a
+ *                tiled photo, reading tiles as needed.
+ *   INPUTS: t -- the tiled photo
+ *           (x,y) -- leftmost pixel of line
+ *           n -- number of pixels in line
+ *   OUTPUTS: buf -- the pixels (0 outside the photo or for tiles that
+ *                   can't be read)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may read tiles into the cache and drop others
+ */
+void
+photo_tiles_fill_row (photo_tiles_t* t, int x, int y, int n, uint8_t* buf)
+{
+    const uint8_t* tile;	/* pixels of current tile     */
+    int            idx;		/* index over pixels in line  */
+    int            len;		/* pixels taken from one tile */
+    int            off;		/* x offset of line in tile   */
+
+    (void)pthread_mutex_lock (&tile_lock);
+    for (idx = 0; n > idx; idx += len) {
+	/* Pixels outside the photo are black. */
+	if (0 > y || t->hdr.height <= y || t->hdr.width <= x + idx) {
+	    len = n - idx;
+	    memset (buf + idx, 0, len);
+	    continue;
+	}
+	if (0 > x + idx) {
+	    len = (n - idx < -(x + idx) ? n - idx : -(x + idx));
+	    memset (buf + idx, 0, len);
+	    continue;
+	}
+
+	/* Copy the part of the line that lies in this tile. */
+	off = (x + idx) % QPHOTO_TILE_SIZE;
+	len = QPHOTO_TILE_SIZE - off;
+	if (n - idx < len) {
+	    len = n - idx;
+	}
+	if (t->hdr.width - (x + idx) < len) {
+	    len = t->hdr.width - (x + idx);
+	}
+	if (NULL == (tile = get_tile (t, (x + idx) / QPHOTO_TILE_SIZE,
+				      y / QPHOTO_TILE_SIZE))) {
+	    memset (buf + idx, 0, len);
+	} else {
+	    memcpy (buf + idx,
+		    tile + (y % QPHOTO_TILE_SIZE) * QPHOTO_TILE_SIZE + off,
+		    len);
+	}
+    }
+    (void)pthread_mutex_unlock (&tile_lock);
+}
+
+
+/*
+ * photo_tiles_fill_column
+ *   DESCRIPTION: Fill a buffer with the pixels of a vertical line of a
+ *                tiled photo, reading tiles as needed.
+ *   INPUTS: t -- the tiled photo
+ *           (x,y) -- top pixel of line
+ *           n -- number of pixels in line
+ *   OUTPUTS: buf -- the pixels (0 outside the photo or for tiles that
+ *                   can't be read)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may read tiles into the cache and drop others
+ */
+void
+photo_tiles_fill_column (photo_tiles_t* t, int x, int y, int n, uint8_t* buf)
+{
+    const uint8_t* tile;	/* pixels of current tile     */
+    int            idx;		/* index over pixels in line  */
+    int            len;		/* pixels taken from one tile */
+    int            off;		/* y offset of line in tile   */
+    int            i;		/* index over pixels in tile  */
+
+    (void)pthread_mutex_lock (&tile_lock);
+    for (idx = 0; n > idx; idx += len) {
+	/* Pixels outside the photo are black. */
+	if (0 > x || t->hdr.width <= x || t->hdr.height <= y + idx) {
+	    len = n - idx;
+	    memset (buf + idx, 0, len);
+	    continue;
+	}
+	if (0 > y + idx) {
+	    len = (n - idx < -(y + idx) ? n - idx : -(y + idx));
+	    memset (buf + idx, 0, len);
+	    continue;
+	}
+
+	/* Copy the part of the line that lies in this tile. */
+	off = (y + idx) % QPHOTO_TILE_SIZE;
+	len = QPHOTO_TILE_SIZE - off;
+	if (n - idx < len) {
+	    len = n - idx;
+	}
+	if (t->hdr.height - (y + idx) < len) {
+	    len = t->hdr.height - (y + idx);
+	}
+	if (NULL == (tile = get_tile (t, x / QPHOTO_TILE_SIZE,
+				      (y + idx) / QPHOTO_TILE_SIZE))) {
+	    memset (buf + idx, 0, len);
+	    continue;
+	}
+	tile += off * QPHOTO_TILE_SIZE + x % QPHOTO_TILE_SIZE;
+	for (i = 0; len > i; i++) {
+	    buf[idx + i] = tile[i * QPHOTO_TILE_SIZE];
+	}
+    }
+    (void)pthread_mutex_unlock (&tile_lock);
+}
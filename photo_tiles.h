@@ -0,0 +1,63 @@
+/*									tab:8
+ *
+ * photo_tiles.h - on-demand tiles of tiled room photos, header file
+ *
+ * Filename:	    photo_tiles.h
+ * History:
+ *	1	First written.
+ */
+#ifndef PHOTO_TILES_H
+#define PHOTO_TILES_H
+
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "photo_headers.h"
+
+
+/*
+ * The pixels of a tiled photo (see qphoto.h) are never all in memory at
+ * once.  Instead, tiles are read and decoded when the screen is drawn
+ * and kept in a cache of PHOTO_TILE_CACHE tiles shared by all tiled
+ * photos.  When a tile is needed and the cache is full, a tile of
+ * another photo is dropped if there is one, and otherwise the tile of
+ * the same photo that lies farthest from the one needed.  Memory used
+ * for tiled photos thus stays bounded however large they are: the
+ * cache, plus a few bytes per tile for each open photo.
+ *
+ * The cache must hold every tile touched by one line drawn on the screen.
+ */
+#if !defined(PHOTO_TILE_CACHE)
+#define PHOTO_TILE_CACHE 64	/* tiles kept in memory (at least 8) */
+#endif
+
+typedef struct photo_tiles_t photo_tiles_t;
+
+/*
+ * Prepare to read tiles of a tiled photo with dimensions hdr.  The stream
+ * must be positioned at the tile index, just after the file header, and
+ * is kept (and eventually closed) by the tiled photo.  Returns NULL on
+ * failure, in which case the stream is not closed.
+ */
+extern photo_tiles_t* photo_tiles_open (FILE* in, const photo_header_t* hdr);
+
+/* Close a tiled photo, dropping its tiles from the cache. */
+extern void photo_tiles_close (photo_tiles_t* t);
+
+/* Get the number of bytes of memory used by a tiled photo's tables. */
+extern uint32_t photo_tiles_size (const photo_tiles_t* t);
+
+/*
+ * Fill n bytes of buf with the pixels of a horizontal line starting at
+ * (x,y).  Pixels outside the photo are color 0, as are pixels of tiles
+ * that can't be read.
+ */
+extern void photo_tiles_fill_row (photo_tiles_t* t, int x, int y, int n,
+				  uint8_t* buf);
+
+/* As photo_tiles_fill_row, but for a vertical line starting at (x,y). */
+extern void photo_tiles_fill_column (photo_tiles_t* t, int x, int y, int n,
+				     uint8_t* buf);
+
+#endif /* PHOTO_TILES_H */
@@ -0,0 +1,368 @@
+/*									tab:8
+ *
+ * planebench.c - mode X build buffer write benchmark
+ *
+ * Filename:	    planebench.c
+ * History:
+ *	1	First written.
+ */
+
+/*
+ * This file is a standalone utility program that measures how fast lines
+ * of a room can be written into the four planes of a mode X build buffer
+ * (see modex.c), either by scattering the pixels of a row-major line one
+ * byte at a time into the planes, as copy_to_planes does, or by copying
+ * them from a copy of the room already split into planes, as
+ * fill_planar_buffer does with PLANAR_LAYER (see photo.h).  Usage:
+ *
+ *     planebench [-n <runs>] <photo file>...
+ *
+ * For each photo, one horizontal line of SCROLL_X_DIM pixels is written
+ * at every y position down the photo, and one vertical line of
+ * SCROLL_Y_DIM pixels at every x position across it, as scrolling across
+ * the whole photo would write them, both ways.  Horizontal lines start
+ * at x positions with every alignment to the planes, and photos smaller
+ * than the screen are padded with color 0.  The sweeps are
+ * repeated <runs> times (default 20), and the fastest times are
+ * reported.  The pixel values do not matter here, so the low byte of
+ * each 5:6:5 pixel is used.
+ *
+ * Output is tab-separated text, one line per photo, after a header line
+ * naming the columns:
+ *
+ *     file        photo file name (or "TOTAL" for the sum over all photos)
+ *     width       photo width in pixels
+ *     height      photo height in pixels
+ *     h_scatter   time per horizontal line (ns), scattering bytes
+ *     h_planar    time per horizontal line (ns), copying plane rows
+ *     v_scatter   time per vertical line (ns), scattering bytes
+ *     v_planar    time per vertical line (ns), copying from one plane
+ *     h_speedup   h_scatter / h_planar
+ *
+ * The exit status is 0 on success and 2 if any photo cannot be read.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modex.h"
+#include "photo_headers.h"
+
+
+#define MAX_WIDTH   1024	/* largest photo width accepted  */
+#define MAX_HEIGHT  1024	/* largest photo height accepted */
+#define DEFAULT_RUNS 20		/* runs per photo by default     */
+
+// build buffer plane size, as in modex.c
+#define SCROLL_SIZE (SCROLL_X_WIDTH * SCROLL_Y_DIM)
+
+
+// Results for one photo (or the total over several).
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t h_lines;		// horizontal lines written per sweep
+    uint32_t v_lines;		// vertical lines written per sweep
+    double   h_scatter_ms;	// time per horizontal sweep, scattering
+    double   h_planar_ms;	// time per horizontal sweep, planar
+    double   v_scatter_ms;	// time per vertical sweep, scattering
+    double   v_planar_ms;	// time per vertical sweep, planar
+} result_t;
+
+
+// The build buffer written: four planes, with room for the (x >> 2)
+// offset of lines that don't start on plane 0, plus one byte.
+static uint8_t build[SCROLL_SIZE * 4 + SCROLL_X_WIDTH + 1];
+
+// Keep the compiler from optimizing away the copies.
+static volatile uint8_t sink;
+
+
+// Get the time in milliseconds from a monotonic clock.
+static double
+now_ms ()
+{
+    struct timespec ts;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Read a photo's pixels into a row-major buffer of one byte per pixel,
+// padded with color 0 to a width (*pw) that is a multiple of 4 and leaves
+// room for a line at every alignment, and to a height (*ph) of at least
+// one screen.  Return pointer to pixels on success, or NULL on failure.
+static uint8_t*
+read_pixels (const char* fname, photo_header_t* h, uint32_t* pw, 
+	     uint32_t* ph)
+{
+    FILE*     in;
+    uint16_t* pix = NULL;
+    uint8_t*  img = NULL;
+    uint32_t  x, y;
+
+    if (NULL != (in = fopen (fname, "rb")) &&
+	1 == fread (h, sizeof (*h), 1, in)) {
+	*pw = (SCROLL_X_DIM + 4 < h->width ? (h->width + 3) & ~3 : 
+	       SCROLL_X_DIM + 4);
+	*ph = (SCROLL_Y_DIM < h->height ? h->height : SCROLL_Y_DIM);
+    }
+    if (NULL == in || feof (in) || ferror (in) ||
+	MAX_WIDTH < h->width || MAX_HEIGHT < h->height ||
+	NULL == (pix = malloc (h->width * h->height * sizeof (pix[0]))) ||
+	NULL == (img = calloc (*pw, *ph)) ||
+	1 != fread (pix, h->width * h->height * sizeof (pix[0]), 1, in)) {
+	fprintf (stderr, "%s could not be read as a room photo.\n", fname);
+	free (pix);
+	free (img);
+	if (NULL != in) {
+	    (void)fclose (in);
+	}
+	return NULL;
+    }
+    (void)fclose (in);
+    for (y = 0; h->height > y; y++) {
+	for (x = 0; h->width > x; x++) {
+	    img[*pw * y + x] = pix[h->width * y + x];
+	}
+    }
+    free (pix);
+    return img;
+}
+
+// Write n pixels of a line into the build buffer planes one byte at a
+// time, starting with logical pixel (x,y), as copy_to_planes does.
+static void
+scatter (const uint8_t* buf, int x, int y, int n, int step)
+{
+    uint8_t* addr = build + (x >> 2) + y * SCROLL_X_WIDTH;
+    int      p_off = 3 - (x & 3);
+    int      i;
+
+    // Horizontal lines move across planes; vertical ones stay in one.
+    for (i = 0; n > i; i++) {
+	addr[p_off * SCROLL_SIZE] = buf[i];
+	if (0 != step) {
+	    addr += step;
+	} else if (0 > --p_off) {
+	    p_off = 3;
+	    addr++;
+	}
+    }
+}
+
+// Sweep horizontal lines down a row-major image (w bytes per row),
+// scattering each into the planes.
+static void
+sweep_h_scatter (const uint8_t* img, uint32_t w, uint32_t h)
+{
+    uint32_t y;
+
+    for (y = 0; h > y; y++) {
+	scatter (img + w * y + (y & 3), y & 3, y % SCROLL_Y_DIM,
+		 SCROLL_X_DIM, 0);
+    }
+    sink = build[sink];
+}
+
+// Copy a w by n rectangle at (x,y) of a planar image (four planes of pw
+// bytes by h rows) into the planes at build buffer position (bx,by), as
+// fill_planar_buffer does.  bx must equal x modulo 4.
+static void
+copy_planes (const uint8_t* planes, uint32_t pw, uint32_t h, int x, int y,
+	     int w, int n, int bx, int by)
+{
+    uint8_t* dst;
+    int      k, first, len, row;
+    const uint8_t* src;
+
+    for (k = 0; 4 > k; k++) {
+	first = x + ((k - x) & 3);
+	if (x + w <= first) {
+	    continue;
+	}
+	len = (x + w - first + 3) >> 2;
+	src = planes + pw * (h * k + y) + (first >> 2);
+	dst = build + (3 - k) * SCROLL_SIZE + ((bx + first - x) >> 2) +
+	      by * SCROLL_X_WIDTH;
+	if (1 == len) {
+	    for (row = 0; n > row; row++) {
+		dst[SCROLL_X_WIDTH * row] = src[pw * row];
+	    }
+	    continue;
+	}
+	for (row = 0; n > row; row++) {
+	    memcpy (dst + SCROLL_X_WIDTH * row, src + pw * row, len);
+	}
+    }
+}
+
+// Sweep horizontal lines down a planar image.
+static void
+sweep_h_planar (const uint8_t* planes, uint32_t pw, uint32_t h)
+{
+    uint32_t y;
+
+    for (y = 0; h > y; y++) {
+	copy_planes (planes, pw, h, y & 3, y, SCROLL_X_DIM, 1, y & 3,
+		     y % SCROLL_Y_DIM);
+    }
+    sink = build[sink];
+}
+
+// Sweep vertical lines across a column-major image (the column layer
+// kept with COLUMN_LAYER), scattering each into one plane.  Lines wrap
+// around the build buffer, which is only one screen wide, keeping the
+// plane of each line.
+static void
+sweep_v_scatter (const uint8_t* cols, uint32_t w, uint32_t h)
+{
+    uint32_t x;
+
+    for (x = 0; w - 3 > x; x++) {
+	scatter (cols + h * x, x % SCROLL_X_DIM, 0, SCROLL_Y_DIM, 
+		 SCROLL_X_WIDTH);
+    }
+    sink = build[sink];
+}
+
+// Sweep vertical lines across a planar image.
+static void
+sweep_v_planar (const uint8_t* planes, uint32_t pw, uint32_t w, uint32_t h)
+{
+    uint32_t x;
+
+    for (x = 0; w - 3 > x; x++) {
+	copy_planes (planes, pw, h, x, 0, 1, SCROLL_Y_DIM, x % SCROLL_X_DIM,
+		     0);
+    }
+    sink = build[sink];
+}
+
+// Time all four sweeps over one photo runs times, keeping the fastest
+// times.  Return 0 on success, or -1 on failure.
+static int32_t
+bench_photo (const char* fname, int runs, result_t* r)
+{
+    photo_header_t hdr;
+    uint8_t*       img;
+    uint8_t*       cols;
+    uint8_t*       planes;
+    uint32_t       w, h, pw, x, y;
+    double         t[5];
+    int            run;
+
+    if (NULL == (img = read_pixels (fname, &hdr, &w, &h))) {
+	return -1;
+    }
+    cols = malloc (w * h);
+    planes = malloc (w * h);
+    if (NULL == cols || NULL == planes) {
+	fprintf (stderr, "out of memory\n");
+	free (img);
+	free (cols);
+	free (planes);
+	return -1;
+    }
+    pw = w >> 2;
+    for (y = 0; h > y; y++) {
+	for (x = 0; w > x; x++) {
+	    cols[h * x + y] = img[w * y + x];
+	    planes[pw * (h * (x & 3) + y) + (x >> 2)] = img[w * y + x];
+	}
+    }
+
+    memset (r, 0, sizeof (*r));
+    r->width = hdr.width;
+    r->height = hdr.height;
+    r->h_lines = h;
+    r->v_lines = w - 3;
+    for (run = 0; runs > run; run++) {
+	t[0] = now_ms ();
+	sweep_h_scatter (img, w, h);
+	t[1] = now_ms ();
+	sweep_h_planar (planes, pw, h);
+	t[2] = now_ms ();
+	sweep_v_scatter (cols, w, h);
+	t[3] = now_ms ();
+	sweep_v_planar (planes, pw, w, h);
+	t[4] = now_ms ();
+	if (0 == run || t[1] - t[0] < r->h_scatter_ms) {
+	    r->h_scatter_ms = t[1] - t[0];
+	}
+	if (0 == run || t[2] - t[1] < r->h_planar_ms) {
+	    r->h_planar_ms = t[2] - t[1];
+	}
+	if (0 == run || t[3] - t[2] < r->v_scatter_ms) {
+	    r->v_scatter_ms = t[3] - t[2];
+	}
+	if (0 == run || t[4] - t[3] < r->v_planar_ms) {
+	    r->v_planar_ms = t[4] - t[3];
+	}
+    }
+    free (img);
+    free (cols);
+    free (planes);
+    return 0;
+}
+
+// Print one line of results.
+static void
+print_result (const char* fname, const result_t* r)
+{
+    double hl = (0 == r->h_lines ? 1 : r->h_lines) / 1000000.0;
+    double vl = (0 == r->v_lines ? 1 : r->v_lines) / 1000000.0;
+    double h_scatter = r->h_scatter_ms / hl;
+    double h_planar = r->h_planar_ms / hl;
+
+    printf ("%s\t%u\t%u\t%.1f\t%.1f\t%.1f\t%.1f\t%.2f\n", fname, r->width,
+	    r->height, h_scatter, h_planar, r->v_scatter_ms / vl,
+	    r->v_planar_ms / vl, 0 < h_planar ? h_scatter / h_planar : 0.0);
+}
+
+int
+main (int argc, char* argv[])
+{
+    int      runs = DEFAULT_RUNS;
+    int      i;
+    int      opt;
+    int      status = 0;
+    result_t r;
+    result_t total;
+
+    // Check syntax of invocation.
+    while (-1 != (opt = getopt (argc, argv, "n:"))) {
+	switch (opt) {
+	    case 'n': runs = atoi (optarg); break;
+	    default: runs = 0; break;
+	}
+    }
+    if (optind >= argc || 0 >= runs) {
+	fprintf (stderr, "usage: %s [-n <runs>] <photo file>...\n", argv[0]);
+	return 2;
+    }
+
+    printf ("file\twidth\theight\th_scatter\th_planar\tv_scatter\t"
+	    "v_planar\th_speedup\n");
+    memset (&total, 0, sizeof (total));
+    for (i = optind; argc > i; i++) {
+	if (0 != bench_photo (argv[i], runs, &r)) {
+	    status = 2;
+	    continue;
+	}
+	print_result (argv[i], &r);
+	total.h_lines += r.h_lines;
+	total.v_lines += r.v_lines;
+	total.h_scatter_ms += r.h_scatter_ms;
+	total.h_planar_ms += r.h_planar_ms;
+	total.v_scatter_ms += r.v_scatter_ms;
+	total.v_planar_ms += r.v_planar_ms;
+    }
+    print_result ("TOTAL", &total);
+    return status;
+}
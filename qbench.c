@@ -0,0 +1,275 @@
+/*									tab:8
+ *
+ * qbench.c - room photo quantization benchmark
+ *
+ * Filename:	    qbench.c
+ * History:
+ *	1	First written.
+ */
+
+/*
+ * This file is a standalone utility program that measures how fast room
+ * photos (5:6:5 RGB, as written by mp2photo) are decoded and quantized,
+ * and how closely the quantized photo matches the original.  Usage:
+ *
+ *     qbench [-m <method>|all] [-n <runs>] <photo file>...
+ *
+ * The quantizer defaults to ADVENTURE_QUANTIZER, as for the game; with
+ * "-m all" every method is measured in turn.  Each photo is decoded and
+ * quantized <runs> times (default 5), and the fastest time is reported.
+ *
+ * Output is tab-separated text, one line per photo and method, after a
+ * header line naming the columns:
+ *
+ *     method    quantizer name
+ *     file      photo file name (or "TOTAL" for the sum over all photos)
+ *     width     photo width in pixels
+ *     height    photo height in pixels
+ *     decode_ms time to read the file into 5:6:5 pixels, top row first
+ *     quant_ms  time to choose the palette and map the pixels
+ *     mpix_s    megapixels per second for decode and quantize together
+ *     psnr_db   PSNR of the 6-bit palette colors against the 5:6:5
+ *               pixels (scaled to 6 bits per component, as in the game)
+ *     max_err   largest error in any component, in 6-bit units
+ *
+ * The exit status is 0 on success and 2 if any photo cannot be read or
+ * quantized.
+ */
+
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "photo_headers.h"
+#include "quantize.h"
+
+
+#define MAX_WIDTH   1024	/* largest photo width accepted  */
+#define MAX_HEIGHT  1024	/* largest photo height accepted */
+#define DEFAULT_RUNS 5		/* runs per photo by default     */
+
+
+// Results for one photo (or the total over several).
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    double   decode_ms;
+    double   quant_ms;
+    double   sq_err;		// sum of squared component errors
+    uint32_t n_comp;		// number of components compared
+    int      max_err;
+} result_t;
+
+
+// Get the time in milliseconds from a monotonic clock.
+static double
+now_ms ()
+{
+    struct timespec ts;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Read a room photo into dynamically allocated memory, top row first,
+// the same way the game does: one read for all pixels, then flip rows.
+// Return pointer to pixels on success, or NULL on failure.
+static uint16_t*
+decode_photo (const char* fname, photo_header_t* h)
+{
+    FILE*     in;
+    uint16_t* pix = NULL;
+    uint16_t  row[MAX_WIDTH];
+    uint32_t  y;
+
+    if (NULL == (in = fopen (fname, "rb")) ||
+	1 != fread (h, sizeof (*h), 1, in) ||
+	MAX_WIDTH < h->width || MAX_HEIGHT < h->height ||
+	NULL == (pix = malloc (h->width * h->height * sizeof (pix[0]))) ||
+	1 != fread (pix, h->width * h->height * sizeof (pix[0]), 1, in)) {
+	fprintf (stderr, "%s could not be read as a room photo.\n", fname);
+	free (pix);
+	if (NULL != in) {
+	    (void)fclose (in);
+	}
+	return NULL;
+    }
+    (void)fclose (in);
+
+    // Rows are stored from bottom to top; swap them.
+    for (y = 0; h->height / 2 > y; y++) {
+	memcpy (row, pix + h->width * y, h->width * sizeof (pix[0]));
+	memcpy (pix + h->width * y, pix + h->width * (h->height - 1 - y),
+		h->width * sizeof (pix[0]));
+	memcpy (pix + h->width * (h->height - 1 - y), row,
+		h->width * sizeof (pix[0]));
+    }
+    return pix;
+}
+
+// Compare the quantized photo with its 5:6:5 pixels, adding squared
+// errors and the largest error to the result.
+static void
+measure_error (const uint16_t* pix, uint32_t n_pix,
+	       uint8_t palette[QUANT_COLORS][3], const uint8_t* img,
+	       result_t* r)
+{
+    uint32_t idx;
+    int      src[3];
+    int      c;
+    int      err;
+
+    for (idx = 0; n_pix > idx; idx++) {
+	src[0] = ((pix[idx] >> 11) & 0x1F) << 1;
+	src[1] = (pix[idx] >> 5) & 0x3F;
+	src[2] = (pix[idx] & 0x1F) << 1;
+	for (c = 0; 3 > c; c++) {
+	    err = abs (src[c] - palette[img[idx] - QUANT_FIRST_COLOR][c]);
+	    r->sq_err += err * err;
+	    if (r->max_err < err) {
+		r->max_err = err;
+	    }
+	}
+    }
+    r->n_comp += 3 * n_pix;
+}
+
+// Decode and quantize one photo runs times with the current method,
+// keeping the fastest times.  Return 0 on success, or -1 on failure.
+static int32_t
+bench_photo (const char* fname, int runs, result_t* r)
+{
+    photo_header_t hdr;
+    uint16_t*      pix;
+    uint8_t        palette[QUANT_COLORS][3];
+    uint8_t*       img = NULL;
+    double         t0, t1, t2;
+    int            run;
+
+    memset (r, 0, sizeof (*r));
+    for (run = 0; runs > run; run++) {
+	t0 = now_ms ();
+	if (NULL == (pix = decode_photo (fname, &hdr))) {
+	    free (img);
+	    return -1;
+	}
+	t1 = now_ms ();
+	if ((NULL == img &&
+	     NULL == (img = malloc (hdr.width * hdr.height))) ||
+	    0 != quantize (pix, hdr.width * hdr.height, palette, img)) {
+	    fprintf (stderr, "%s could not be quantized.\n", fname);
+	    free (pix);
+	    free (img);
+	    return -1;
+	}
+	t2 = now_ms ();
+	if (0 == run || t1 - t0 < r->decode_ms) {
+	    r->decode_ms = t1 - t0;
+	}
+	if (0 == run || t2 - t1 < r->quant_ms) {
+	    r->quant_ms = t2 - t1;
+	}
+
+	// The result is the same every run; check its quality once.
+	if (0 == run) {
+	    r->width = hdr.width;
+	    r->height = hdr.height;
+	    measure_error (pix, hdr.width * hdr.height, palette, img, r);
+	}
+	free (pix);
+    }
+    free (img);
+    return 0;
+}
+
+// Print one line of results.  Totals have no dimensions of their own,
+// so their pixel count is passed separately.
+static void
+print_result (const char* method, const char* fname, const result_t* r,
+	      double n_pix)
+{
+    double mse = r->sq_err / (0 == r->n_comp ? 1 : r->n_comp);
+    double ms = r->decode_ms + r->quant_ms;
+
+    printf ("%s\t%s\t%u\t%u\t%.3f\t%.3f\t%.2f\t", method, fname, r->width,
+	    r->height, r->decode_ms, r->quant_ms,
+	    0 < ms ? n_pix / ms / 1000.0 : 0.0);
+    if (0 < mse) {
+	printf ("%.2f", 10.0 * log10 (63.0 * 63.0 / mse));
+    } else {
+	printf ("inf");
+    }
+    printf ("\t%d\n", r->max_err);
+}
+
+int
+main (int argc, char* argv[])
+{
+    const char* method = getenv ("ADVENTURE_QUANTIZER");
+    int         runs = DEFAULT_RUNS;
+    int         first, last;	// methods to measure
+    int         m;
+    int         i;
+    int         opt;
+    int         status = 0;
+    result_t    r;
+    result_t    total;
+    double      n_pix;
+
+    // Check syntax of invocation.
+    while (-1 != (opt = getopt (argc, argv, "m:n:"))) {
+	switch (opt) {
+	    case 'm': method = optarg; break;
+	    case 'n': runs = atoi (optarg); break;
+	    default: runs = 0; break;
+	}
+    }
+    if (optind >= argc || 0 >= runs) {
+	fprintf (stderr, "usage: %s [-m <method>|all] [-n <runs>] "
+		 "<photo file>...\n", argv[0]);
+	return 2;
+    }
+
+    // Choose the methods to measure.
+    if (NULL != method && 0 == strcmp (method, "all")) {
+	first = 0;
+	last = NUM_QUANT_METHODS - 1;
+    } else {
+	if (NULL != method && 0 != quantize_set_method (method)) {
+	    fprintf (stderr, "unknown quantizer method %s\n", method);
+	    return 2;
+	}
+	first = last = quantize_get_method ();
+    }
+
+    printf ("method\tfile\twidth\theight\tdecode_ms\tquant_ms\tmpix_s\t"
+	    "psnr_db\tmax_err\n");
+    for (m = first; last >= m; m++) {
+	quantize_set_method (quantize_method_name (m));
+	memset (&total, 0, sizeof (total));
+	n_pix = 0;
+	for (i = optind; argc > i; i++) {
+	    if (0 != bench_photo (argv[i], runs, &r)) {
+		status = 2;
+		continue;
+	    }
+	    print_result (quantize_method_name (m), argv[i], &r,
+			  (double)r.width * r.height);
+	    n_pix += (double)r.width * r.height;
+	    total.decode_ms += r.decode_ms;
+	    total.quant_ms += r.quant_ms;
+	    total.sq_err += r.sq_err;
+	    total.n_comp += r.n_comp;
+	    if (total.max_err < r.max_err) {
+		total.max_err = r.max_err;
+	    }
+	}
+	print_result (quantize_method_name (m), "TOTAL", &total, n_pix);
+    }
+    return status;
+}
@@ -0,0 +1,357 @@
+/*									tab:8
+ *
+ * qphoto.c - compressed indexed room photo container
+ *
+ * Filename:	    qphoto.c
+ * History:
+ *	1	First written.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "qphoto.h"
+
+
+#define MIN_RUN     3		/* shortest run or copy coded     */
+#define MAX_RUN     (MIN_RUN + 0x3F) /* longest run or copy coded */
+#define MAX_LITERAL 0x80	/* longest literal coded          */
+#define MAX_WIDTH   1024	/* widest row handled             */
+
+#define CODE_RUN    0x80	/* code bits for a run            */
+#define CODE_COPY   0xC0	/* code bits for a copy           */
+#define NO_LITERAL  0xFFFFFFFF	/* no literal is being extended   */
+
+
+/*
+ * encode_row
+ *   DESCRIPTION: Compress one row of pixels.  At each position, the
+ *                longer of a run of one color and a copy of the row
+ *                above is coded if it covers at least MIN_RUN pixels;
+ *                other pixels are gathered into literals.
+ *   INPUTS: row -- the row of VGA colors
+ *           above -- the row above, or NULL for the top row
+ *           width -- pixels per row
+ *   OUTPUTS: out -- code bytes (at most QPHOTO_ROW_BOUND (width))
+ *   RETURN VALUE: number of code bytes written
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+encode_row (const uint8_t* row, const uint8_t* above, uint32_t width,
+	    uint8_t* out)
+{
+    uint32_t x;		/* index over pixels in row           */
+    uint32_t len;	/* number of code bytes written       */
+    uint32_t lit;	/* index of code for current literal  */
+			/*   (or NO_LITERAL)                  */
+    uint32_t run;	/* length of run of one color         */
+    uint32_t copy;	/* length of match with row above     */
+
+    len = 0;
+    lit = NO_LITERAL;
+    for (x = 0; width > x; ) {
+	for (run = 1; width > x + run && MAX_RUN > run &&
+		      row[x + run] == row[x]; run++) {
+	}
+	copy = 0;
+	if (NULL != above) {
+	    for (; width > x + copy && MAX_RUN > copy &&
+		   row[x + copy] == above[x + copy]; copy++) {
+	    }
+	}
+	if (MIN_RUN <= copy && copy >= run) {
+	    out[len++] = CODE_COPY | (copy - MIN_RUN);
+	    x += copy;
+	    lit = NO_LITERAL;
+	} else if (MIN_RUN <= run) {
+	    out[len++] = CODE_RUN | (run - MIN_RUN);
+	    out[len++] = row[x];
+	    x += run;
+	    lit = NO_LITERAL;
+	} else {
+	    /* Extend the current literal, or start a new one. */
+	    if (NO_LITERAL == lit || MAX_LITERAL - 1 == out[lit]) {
+		lit = len++;
+		out[lit] = 0;
+	    } else {
+		out[lit]++;
+	    }
+	    out[len++] = row[x++];
+	}
+    }
+    return len;
+}
+
+
+/*
+ * decode_row
+ *   DESCRIPTION: Decompress one row of pixels.
+ *   INPUTS: in -- code bytes
+ *           len -- number of code bytes
+ *           above -- the row above, or NULL for the top row
+ *           width -- pixels per row
+ *   OUTPUTS: row -- the row of VGA colors
+ *   RETURN VALUE: 0 on success, or -1 if the codes are corrupt or do
+ *                 not produce exactly width pixels
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+decode_row (const uint8_t* in, uint32_t len, const uint8_t* above, 
+	    uint32_t width, uint8_t* row)
+{
+    const uint8_t* end = in + len; /* end of code bytes           */
+    uint32_t       x;		   /* index over pixels in row    */
+    uint32_t       n;		   /* pixels produced by one code */
+    uint8_t        code;	   /* current code byte           */
+
+    for (x = 0; end > in; x += n) {
+	code = *in++;
+	if (CODE_COPY == (code & CODE_COPY)) {
+	    n = (code & 0x3F) + MIN_RUN;
+	    if (NULL == above || width - x < n) {
+		return -1;
+	    }
+	    memcpy (row + x, above + x, n);
+	} else if (CODE_RUN == (code & CODE_COPY)) {
+	    n = (code & 0x3F) + MIN_RUN;
+	    if (end == in || width - x < n) {
+		return -1;
+	    }
+	    memset (row + x, *in++, n);
+	} else {
+	    n = code + 1;
+	    if ((uint32_t)(end - in) < n || width - x < n) {
+		return -1;
+	    }
+	    memcpy (row + x, in, n);
+	    in += n;
+	}
+    }
+    return (width == x ? 0 : -1);
+}
+
+
+/*
+ * write_rows
+ *   DESCRIPTION: Write pixels from a block of an image as compressed rows.
+ *   INPUTS: out -- output file stream
+ *           img -- top left pixel of block
+ *           stride -- distance in bytes from one image row to the next
+ *           width -- pixels per row of block (at most MAX_WIDTH)
+ *           height -- number of rows in block
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: writes to out
+ */
+static int32_t
+write_rows (FILE* out, const uint8_t* img, uint32_t stride, uint32_t width,
+	    uint32_t height)
+{
+    uint8_t  codes[QPHOTO_ROW_BOUND (MAX_WIDTH)]; /* one compressed row */
+    uint16_t len;	/* code bytes in row  */
+    uint32_t y;		/* index over rows    */
+
+    if (MAX_WIDTH < width) {
+	return -1;
+    }
+    for (y = 0; height > y; y++) {
+	len = encode_row (img + y * stride, 
+			  (0 == y ? NULL : img + (y - 1) * stride), width,
+			  codes);
+	if (1 != fwrite (&len, sizeof (len), 1, out) ||
+	    len != fwrite (codes, 1, len, out)) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * read_rows
+ *   DESCRIPTION: Read compressed rows, decoding each straight into place
+ *                in a block of an image.
+ *   INPUTS: in -- input file stream
+ *           stride -- distance in bytes from one image row to the next
+ *           width -- pixels per row of block (at most MAX_WIDTH)
+ *           height -- number of rows in block
+ *   OUTPUTS: img -- block of VGA colors, starting at its top left pixel
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: reads from in
+ */
+static int32_t
+read_rows (FILE* in, uint8_t* img, uint32_t stride, uint32_t width, 
+	   uint32_t height)
+{
+    uint8_t  codes[QPHOTO_ROW_BOUND (MAX_WIDTH)]; /* one compressed row */
+    uint16_t len;	/* code bytes in row  */
+    uint32_t y;		/* index over rows    */
+
+    if (MAX_WIDTH < width) {
+	return -1;
+    }
+    for (y = 0; height > y; y++) {
+	if (1 != fread (&len, sizeof (len), 1, in) ||
+	    sizeof (codes) < len ||
+	    len != fread (codes, 1, len, in) ||
+	    0 != decode_row (codes, len, 
+	    		     (0 == y ? NULL : img + (y - 1) * stride), width, 
+			     img + y * stride)) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * qphoto_write_rows
+ *   DESCRIPTION: Write pixels as compressed rows.
+ *   INPUTS: out -- output file stream
+ *           img -- width * height VGA colors, top row first
+ *           width -- pixels per row (at most MAX_WIDTH)
+ *           height -- number of rows
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: writes to out
+ */
+int32_t
+qphoto_write_rows (FILE* out, const uint8_t* img, uint32_t width, 
+		   uint32_t height)
+{
+    return write_rows (out, img, width, width, height);
+}
+
+
+/*
+ * qphoto_read_rows
+ *   DESCRIPTION: Read compressed rows, decoding each straight into place.
+ *   INPUTS: in -- input file stream
+ *           width -- pixels per row (at most MAX_WIDTH)
+ *           height -- number of rows
+ *   OUTPUTS: img -- width * height VGA colors, top row first
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: reads from in
+ */
+int32_t
+qphoto_read_rows (FILE* in, uint8_t* img, uint32_t width, uint32_t height)
+{
+    return read_rows (in, img, width, width, height);
+}
+
+
+/*
+ * qphoto_read_tile
+ *   DESCRIPTION: Read and decode one tile of a tiled photo.
+ *   INPUTS: in -- input file stream, positioned at the tile's data
+ *           width -- pixels per row of the tile
+ *           height -- number of rows in the tile
+ *   OUTPUTS: tile -- the tile's VGA colors, in rows of QPHOTO_TILE_SIZE
+ *                    bytes (of which the first width are used)
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: reads from in
+ */
+int32_t
+qphoto_read_tile (FILE* in, uint8_t* tile, uint32_t width, uint32_t height)
+{
+    if (QPHOTO_TILE_SIZE < width || QPHOTO_TILE_SIZE < height) {
+	return -1;
+    }
+    return read_rows (in, tile, QPHOTO_TILE_SIZE, width, height);
+}
+
+
+/*
+ * qphoto_write
+ *   DESCRIPTION: Write a compressed indexed photo.
+ *   INPUTS: out -- output file stream
+ *           hdr -- photo dimensions
+ *           palette -- the photo's palette
+ *           img -- the photo's pixels (VGA colors, top row first)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: writes to out
+ */
+int32_t
+qphoto_write (FILE* out, const photo_header_t* hdr, 
+	      uint8_t palette[QUANT_COLORS][3], const uint8_t* img)
+{
+    qphoto_header_t qh;	/* file header */
+
+    memcpy (qh.magic, QPHOTO_MAGIC, sizeof (qh.magic));
+    qh.hdr = *hdr;
+    memcpy (qh.palette, palette, sizeof (qh.palette));
+    if (1 != fwrite (&qh, sizeof (qh), 1, out)) {
+	return -1;
+    }
+    return qphoto_write_rows (out, img, hdr->width, hdr->height);
+}
+
+
+/*
+ * qphoto_write_tiled
+ *   DESCRIPTION: Write a tiled photo.  The tile index is written once all
+ *                tiles have been written and their positions are known,
+ *                so out must be seekable.
+ *   INPUTS: out -- output file stream, at the start of the file
+ *           hdr -- photo dimensions
+ *           palette -- the photo's palette
+ *           img -- the photo's pixels (VGA colors, top row first)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: writes to out
+ */
+int32_t
+qphoto_write_tiled (FILE* out, const photo_header_t* hdr, 
+		    uint8_t palette[QUANT_COLORS][3], const uint8_t* img)
+{
+    qphoto_header_t qh;		/* file header                */
+    uint32_t*       index;	/* tile index                 */
+    uint32_t        n_tiles;	/* number of tiles            */
+    uint32_t        tiles_x;	/* tiles across photo         */
+    uint32_t        tx;		/* tile column                */
+    uint32_t        ty;		/* tile row                   */
+    uint32_t        i;		/* index over tiles           */
+    long            pos;	/* position of tile in file   */
+    int32_t         rval;	/* return value               */
+
+    tiles_x = QPHOTO_TILES (hdr->width);
+    n_tiles = tiles_x * QPHOTO_TILES (hdr->height);
+    if (NULL == (index = calloc (n_tiles + 1, sizeof (index[0])))) {
+	return -1;
+    }
+    memcpy (qh.magic, QPHOTO_TILED_MAGIC, sizeof (qh.magic));
+    qh.hdr = *hdr;
+    memcpy (qh.palette, palette, sizeof (qh.palette));
+
+    /* Leave room for the index, then write the tiles. */
+    rval = -1;
+    if (1 == fwrite (&qh, sizeof (qh), 1, out) &&
+	0 == fseek (out, (n_tiles + 1) * sizeof (index[0]), SEEK_CUR)) {
+	for (i = 0; n_tiles > i; i++) {
+	    tx = (i % tiles_x) * QPHOTO_TILE_SIZE;
+	    ty = (i / tiles_x) * QPHOTO_TILE_SIZE;
+	    if (0 > (pos = ftell (out)) ||
+		0 != write_rows (out, img + ty * hdr->width + tx, hdr->width,
+				 (hdr->width - tx < QPHOTO_TILE_SIZE ? 
+				  hdr->width - tx : QPHOTO_TILE_SIZE),
+				 (hdr->height - ty < QPHOTO_TILE_SIZE ? 
+				  hdr->height - ty : QPHOTO_TILE_SIZE))) {
+		break;
+	    }
+	    index[i] = pos;
+	}
+	if (n_tiles == i && 0 <= (pos = ftell (out))) {
+	    index[n_tiles] = pos;
+	    if (0 == fseek (out, sizeof (qh), SEEK_SET) &&
+		n_tiles + 1 == fwrite (index, sizeof (index[0]), n_tiles + 1,
+				       out) &&
+		0 == fseek (out, 0, SEEK_END)) {
+		rval = 0;
+	    }
+	}
+    }
+    free (index);
+    return rval;
+}
@@ -0,0 +1,107 @@
+/*									tab:8
+ *
+ * qphoto.h - compressed indexed room photo container, header file
+ *
+ * Filename:	    qphoto.h
+ * History:
+ *	1	First written.
+ */
+#ifndef QPHOTO_H
+#define QPHOTO_H
+
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "photo_headers.h"
+#include "quantize.h"
+
+
+/*
+ * A compressed indexed photo holds a room photo that has already been
+ * quantized: its palette and one VGA color per pixel, stored top row
+ * first with each row compressed.  A file starts with a qphoto_header_t.
+ * The magic sequence comes first, and, read as a photo header, gives a
+ * width too large for any room photo, so read_photo can accept either
+ * kind of file under the same name.
+ *
+ * Each row is stored as a 16-bit byte count followed by that many bytes
+ * of codes.  Each code byte c is followed by its operand, if any:
+ *
+ *   0x00-0x7F  literal:  c + 1 colors follow
+ *   0x80-0xBF  run:      one color follows, repeated (c & 0x3F) + 3 times
+ *   0xC0-0xFF  copy:     (c & 0x3F) + 3 colors are the same as those 
+ *                        directly above (not allowed in the top row)
+ *
+ * Rows can thus be read and decoded one at a time straight into the
+ * photo's pixel data.
+ *
+ * A tiled photo, used for panoramas too big to keep in memory, starts 
+ * with the same header but with QPHOTO_TILED_MAGIC, and may be as large
+ * as QPHOTO_MAX_TILED_WIDTH by QPHOTO_MAX_TILED_HEIGHT.  The photo is cut
+ * into tiles of QPHOTO_TILE_SIZE by QPHOTO_TILE_SIZE pixels (smaller at
+ * the right and bottom edges), numbered across each row of tiles and
+ * then down.  The header is followed by the tile index: one 32-bit file
+ * position per tile, giving the start of the tile's data, and then the
+ * position of the end of the last tile.  Each tile is stored as its own
+ * compressed rows, so that tiles can be read one at a time.
+ */
+#define QPHOTO_MAGIC       "QPH1" /* compressed photo magic sequence  */
+#define QPHOTO_TILED_MAGIC "QPT1" /* tiled photo magic sequence       */
+#define QPHOTO_TILE_SIZE   64	  /* width and height of a tile       */
+#define QPHOTO_MAX_TILED_WIDTH  16384 /* limits on size of tiled photo */
+#define QPHOTO_MAX_TILED_HEIGHT 16384
+
+/* largest number of code bytes needed for a row of width pixels */
+#define QPHOTO_ROW_BOUND(width) ((width) + ((width) + 127) / 128)
+
+/* number of tiles needed to cover n pixels */
+#define QPHOTO_TILES(n) (((n) + QPHOTO_TILE_SIZE - 1) / QPHOTO_TILE_SIZE)
+
+typedef struct qphoto_header_t qphoto_header_t;
+struct qphoto_header_t {
+    char           magic[4];	/* QPHOTO_MAGIC (not terminated)   */
+    photo_header_t hdr;		/* photo dimensions                */
+    uint8_t        palette[QUANT_COLORS][3]; /* 6-bit RGB palette  */
+};
+
+/*
+ * Write width * height VGA colors (top row first) as compressed rows.
+ * Returns 0 on success, or -1 on failure.
+ */
+extern int32_t qphoto_write_rows (FILE* out, const uint8_t* img, 
+				  uint32_t width, uint32_t height);
+
+/*
+ * Read and decode compressed rows into width * height VGA colors (top
+ * row first).  Returns 0 on success, or -1 if the data are short or
+ * corrupt.
+ */
+extern int32_t qphoto_read_rows (FILE* in, uint8_t* img, 
+				 uint32_t width, uint32_t height);
+
+/* 
+ * Write a whole compressed indexed photo.  Returns 0 on success, or -1
+ * on failure.
+ */
+extern int32_t qphoto_write (FILE* out, const photo_header_t* hdr,
+			     uint8_t palette[QUANT_COLORS][3], 
+			     const uint8_t* img);
+
+/* 
+ * Write a whole tiled photo to a seekable stream.  Returns 0 on success,
+ * or -1 on failure.
+ */
+extern int32_t qphoto_write_tiled (FILE* out, const photo_header_t* hdr,
+				   uint8_t palette[QUANT_COLORS][3], 
+				   const uint8_t* img);
+
+/*
+ * Read and decode one tile of width by height pixels, starting at the
+ * current position in the stream.  Rows of the tile are QPHOTO_TILE_SIZE
+ * bytes apart in tile.  Returns 0 on success, or -1 on failure.
+ */
+extern int32_t qphoto_read_tile (FILE* in, uint8_t* tile, uint32_t width,
+				 uint32_t height);
+
+#endif /* QPHOTO_H */
@@ -0,0 +1,1115 @@
+/*									tab:8
+ *
+ * quantize.c - room photo color quantization
+ *
+ * Filename:	    quantize.c
+ * History:
+ *	1	Palette selection split out of photo.c behind a common
+ *		interface, with octree, median-cut, and k-means methods
+ *		added alongside the original histogram method.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "quantize.h"
+
+
+/*
+ * Every method chooses QUANT_COLORS palette colors and fills in an inverse
+ * colormap giving the VGA color for each 5:6:5 color that appears in the
+ * photo (other entries are never read).  Pixels are then mapped with one
+ * table lookup each.  Palette components are 6 bits; as elsewhere in the
+ * game, 5-bit red and blue are scaled up by shifting left one bit.
+ */
+#define RED6(c)   ((((c) >> 11) & 0x1F) << 1)
+#define GREEN6(c) (((c) >> 5) & 0x3F)
+#define BLUE6(c)  (((c) & 0x1F) << 1)
+
+/* 
+ * 4:4:4 histogram bin of a 5:6:5 color: the top four bits of each
+ * component.  The 2:2:2 bin of a 4:4:4 bin is the top two bits of each.
+ */
+#define BIN_444(c)   ((((c) >> 12) << 8) | ((((c) >> 7) & 0xF) << 4) | \
+		      (((c) >> 1) & 0xF))
+#define BIN_222(bin) ((((bin) >> 10) << 4) | ((((bin) >> 6) & 0x3) << 2) | \
+		      (((bin) >> 2) & 0x3))
+
+/* depth of the octree (5 bits of red and blue, top 5 bits of green) */
+#define OCT_DEPTH 5
+
+
+/* types local to this file */
+
+/* color counts and sums for one bin in the histogram method */
+typedef struct octree_arr_t octree_arr_t;
+struct octree_arr_t {
+    int red;		/* sum of 5-bit red components   */
+    int green;		/* sum of 6-bit green components */
+    int blue;		/* sum of 5-bit blue components  */
+    int counter;	/* number of pixels in bin       */
+    int index;		/* bin number                    */
+};
+
+/* a palette selection method */
+typedef int32_t (*quant_fn_t) (const uint16_t* pix, uint32_t n_pix,
+			       uint8_t palette[QUANT_COLORS][3],
+			       uint8_t* cmap);
+
+/* one distinct color appearing in a photo */
+typedef struct color_count_t color_count_t;
+struct color_count_t {
+    uint16_t color;	/* 5:6:5 RGB color          */
+    uint32_t count;	/* number of pixels with it */
+};
+
+/* one node of the octree */
+typedef struct oct_node_t oct_node_t;
+struct oct_node_t {
+    uint32_t count;	/* pixels at or below this node         */
+    uint32_t red;	/* sums of 6-bit components of pixels   */
+    uint32_t green;
+    uint32_t blue;
+    int32_t  child[8];	/* child node numbers, or -1 for none   */
+    uint8_t  level;	/* depth of node (root is 0)            */
+    uint8_t  leaf;	/* 1 if node represents a palette color */
+    uint8_t  color;	/* palette entry for a leaf             */
+};
+
+/* an internal octree node ranked for pruning */
+typedef struct oct_rank_t oct_rank_t;
+struct oct_rank_t {
+    uint32_t count;	/* pixels at or below the node */
+    int32_t  node;	/* node number                 */
+};
+
+/* one box of colors in median cut */
+typedef struct cut_box_t cut_box_t;
+struct cut_box_t {
+    uint32_t first;	/* index of first color in box         */
+    uint32_t n;		/* number of distinct colors in box    */
+    uint32_t count;	/* number of pixels in box             */
+    int32_t  axis;	/* component with greatest range       */
+    int32_t  range;	/* range of that component             */
+};
+
+
+/* functions local to this file--see function headers for details */
+static int compare_bin_counts (const void* a, const void* b);
+static int compare_node_counts (const void* a, const void* b);
+static int compare_red (const void* a, const void* b);
+static int compare_green (const void* a, const void* b);
+static int compare_blue (const void* a, const void* b);
+static color_count_t* count_colors (const uint16_t* pix, uint32_t n_pix,
+				    uint32_t* n_colors);
+static void measure_box (const color_count_t* colors, cut_box_t* box);
+static void median_cut (color_count_t* colors, uint32_t n_colors,
+			uint8_t palette[QUANT_COLORS][3], uint8_t* cmap);
+static uint8_t nearest_color (uint8_t palette[QUANT_COLORS][3],
+			      const uint8_t* used, int red, int green,
+			      int blue);
+static uint8_t nearest_by_green (uint8_t palette[QUANT_COLORS][3],
+				 const uint8_t* order, int n, int red,
+				 int green, int blue);
+static int32_t quantize_histogram (const uint16_t* pix, uint32_t n_pix,
+				   uint8_t palette[QUANT_COLORS][3],
+				   uint8_t* cmap);
+static int32_t quantize_octree (const uint16_t* pix, uint32_t n_pix,
+				uint8_t palette[QUANT_COLORS][3],
+				uint8_t* cmap);
+static int32_t quantize_median_cut (const uint16_t* pix, uint32_t n_pix,
+				    uint8_t palette[QUANT_COLORS][3],
+				    uint8_t* cmap);
+static int32_t quantize_kmeans (const uint16_t* pix, uint32_t n_pix,
+				uint8_t palette[QUANT_COLORS][3],
+				uint8_t* cmap);
+static void make_scratch_key ();
+static void free_scratch (void* arena);
+static arena_t* get_scratch ();
+static void* scratch_alloc (size_t size);
+static void* scratch_zalloc (size_t size);
+
+
+/* file-scope variables */
+
+/*
+ * The palette selection methods, in quant_method_t order.  A method's
+ * version must change whenever its output for some photo does, so that
+ * cached photos quantized by the old version are not used (see
+ * photo_cache.h).  The k-means version also covers its number of rounds
+ * and the median cut it starts from.
+ */
+static const struct {
+    const char* name;	/* name used to select method */
+    quant_fn_t  fn;	/* implementation             */
+    uint32_t    version; /* version of output         */
+} methods[NUM_QUANT_METHODS] = {
+    {"histogram", quantize_histogram,  2},
+    {"octree",    quantize_octree,     1},
+    {"mediancut", quantize_median_cut, 1},
+    {"kmeans",    quantize_kmeans,     1 | QUANT_KMEANS_ROUNDS << 8}
+};
+
+/* the method currently in use */
+static quant_method_t method = QUANT_DEFAULT_METHOD;
+
+/*
+ * Scratch memory for one call to quantize (the inverse colormap, color
+ * counts, and each method's working tables) comes from an arena owned
+ * by the calling thread, which is reset at the start of each call.
+ * After the first photo, a thread quantizes without calling malloc.
+ * Photos may be quantized on several threads at once (see parallel.h),
+ * so each thread has its own arena, freed when the thread exits.
+ */
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  scratch_key;
+
+
+/*
+ * quantize
+ *   DESCRIPTION: Choose a palette for a photo with the current method,
+ *                then map each pixel to its palette color.
+ *   INPUTS: pix -- 5:6:5 RGB pixels
+ *           n_pix -- number of pixels
+ *   OUTPUTS: palette -- the palette colors (6-bit RGB)
+ *            out -- VGA color for each pixel
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t
+quantize (const uint16_t* pix, uint32_t n_pix,
+	  uint8_t palette[QUANT_COLORS][3], uint8_t* out)
+{
+    arena_t* scratch;	/* this thread's scratch memory   */
+    uint8_t* cmap;	/* VGA color for each 5:6:5 color */
+    uint32_t idx;	/* index over pixels              */
+
+    if (NULL == (scratch = get_scratch ())) {
+	return -1;
+    }
+    arena_reset (scratch);
+    if (NULL == (cmap = scratch_alloc (65536 * sizeof (cmap[0])))) {
+	return -1;
+    }
+    (void)memset (palette, 0, QUANT_COLORS * 3);
+    if (0 != (*methods[method].fn) (pix, n_pix, palette, cmap)) {
+	return -1;
+    }
+    for (idx = 0; n_pix > idx; idx++) {
+	out[idx] = cmap[pix[idx]];
+    }
+    return 0;
+}
+
+
+/*
+ * quantize_get_method
+ *   DESCRIPTION: Get the palette selection method currently in use.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the current method
+ *   SIDE EFFECTS: none
+ */
+quant_method_t
+quantize_get_method ()
+{
+    return method;
+}
+
+
+/*
+ * quantize_set_method
+ *   DESCRIPTION: Select the palette selection method by name.
+ *   INPUTS: name -- name of the method
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the name is not recognized
+ *   SIDE EFFECTS: changes the method used by later calls to quantize
+ */
+int32_t
+quantize_set_method (const char* name)
+{
+    int32_t m;	/* index over methods */
+
+    for (m = 0; NUM_QUANT_METHODS > m; m++) {
+	if (0 == strcmp (name, methods[m].name)) {
+	    method = m;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ * quantize_method_name
+ *   DESCRIPTION: Get the name of a palette selection method.
+ *   INPUTS: m -- the method
+ *   OUTPUTS: none
+ *   RETURN VALUE: the method's name (a string)
+ *   SIDE EFFECTS: none
+ */
+const char*
+quantize_method_name (quant_method_t m)
+{
+    return methods[m].name;
+}
+
+
+/*
+ * quantize_method_version
+ *   DESCRIPTION: Get the version of a palette selection method's output.
+ *   INPUTS: m -- the method
+ *   OUTPUTS: none
+ *   RETURN VALUE: the method's version
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+quantize_method_version (quant_method_t m)
+{
+    return methods[m].version;
+}
+
+
+/*
+ * compare_bin_counts
+ *   DESCRIPTION: qsort comparison putting histogram bins with more
+ *                pixels first.
+ *   INPUTS: a, b -- pointers to the bins being compared
+ *   OUTPUTS: none
+ *   RETURN VALUE: -1 if a has more pixels, 1 if b has more, 0 if equal
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_bin_counts (const void* a, const void* b)
+{
+    const octree_arr_t* bin_a = a;
+    const octree_arr_t* bin_b = b;
+
+    if (bin_a->counter > bin_b->counter) {
+	return -1;
+    }
+    return (bin_a->counter < bin_b->counter);
+}
+
+
+/*
+ * compare_node_counts
+ *   DESCRIPTION: qsort comparison putting octree nodes with fewer pixels
+ *                first, and nodes with equal counts in node order.
+ *   INPUTS: a, b -- pointers to the ranked nodes being compared
+ *   OUTPUTS: none
+ *   RETURN VALUE: -1 if a comes first, 1 if b does, 0 if equal
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_node_counts (const void* a, const void* b)
+{
+    const oct_rank_t* rank_a = a;
+    const oct_rank_t* rank_b = b;
+
+    if (rank_a->count != rank_b->count) {
+	return (rank_a->count < rank_b->count ? -1 : 1);
+    }
+    return (rank_a->node > rank_b->node) - (rank_a->node < rank_b->node);
+}
+
+
+/*
+ * compare_red, compare_green, compare_blue
+ *   DESCRIPTION: qsort comparisons ordering distinct colors by one of
+ *                their components.
+ *   INPUTS: a, b -- pointers to the colors being compared
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as a's component is less
+ *                 than, equal to, or greater than b's
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_red (const void* a, const void* b)
+{
+    return (RED6 (((const color_count_t*)a)->color) -
+	    RED6 (((const color_count_t*)b)->color));
+}
+
+static int
+compare_green (const void* a, const void* b)
+{
+    return (GREEN6 (((const color_count_t*)a)->color) -
+	    GREEN6 (((const color_count_t*)b)->color));
+}
+
+static int
+compare_blue (const void* a, const void* b)
+{
+    return (BLUE6 (((const color_count_t*)a)->color) -
+	    BLUE6 (((const color_count_t*)b)->color));
+}
+
+
+/*
+ * count_colors
+ *   DESCRIPTION: Build a list of the distinct colors in a photo along
+ *                with the number of pixels of each.
+ *   INPUTS: pix -- 5:6:5 RGB pixels
+ *           n_pix -- number of pixels
+ *   OUTPUTS: n_colors -- number of distinct colors
+ *   RETURN VALUE: list of colors (in increasing 5:6:5 order) in scratch
+ *                 memory, or NULL on failure
+ *   SIDE EFFECTS: allocates scratch memory
+ */
+static color_count_t*
+count_colors (const uint16_t* pix, uint32_t n_pix, uint32_t* n_colors)
+{
+    uint32_t*      counts;	/* pixels of each 5:6:5 color */
+    color_count_t* colors;	/* list of distinct colors    */
+    uint32_t       idx;		/* index over pixels/colors   */
+    uint32_t       n;		/* number of distinct colors  */
+
+    if (NULL == (counts = scratch_zalloc (65536 * sizeof (counts[0])))) {
+	return NULL;
+    }
+    for (idx = 0; n_pix > idx; idx++) {
+	counts[pix[idx]]++;
+    }
+    for (idx = n = 0; 65536 > idx; idx++) {
+	n += (0 != counts[idx]);
+    }
+    if (NULL == (colors = scratch_alloc ((n + 1) * sizeof (colors[0])))) {
+	return NULL;
+    }
+    for (idx = n = 0; 65536 > idx; idx++) {
+	if (0 != counts[idx]) {
+	    colors[n].color = idx;
+	    colors[n].count = counts[idx];
+	    n++;
+	}
+    }
+    *n_colors = n;
+    return colors;
+}
+
+
+/*
+ * nearest_color
+ *   DESCRIPTION: Find the palette color closest (in squared Euclidean
+ *                distance over 6-bit components) to a given color.
+ *   INPUTS: palette -- the palette
+ *           used -- for each palette color, 0 if it should be skipped
+ *                   (or NULL to consider all colors)
+ *           (red,green,blue) -- the color to match (6 bits each)
+ *   OUTPUTS: none
+ *   RETURN VALUE: index of the nearest palette color
+ *   SIDE EFFECTS: none
+ */
+static uint8_t
+nearest_color (uint8_t palette[QUANT_COLORS][3], const uint8_t* used,
+	       int red, int green, int blue)
+{
+    int best;		/* index of closest palette color so far  */
+    int best_dist;	/* squared distance to closest color      */
+    int dist;		/* squared distance to current color      */
+    int i;		/* index over palette colors              */
+
+    best = 0;
+    best_dist = 0x7FFFFFFF;
+    for (i = 0; QUANT_COLORS > i; i++) {
+	if (NULL != used && !used[i]) {
+	    continue;
+	}
+	dist = (palette[i][0] - red) * (palette[i][0] - red) +
+	       (palette[i][1] - green) * (palette[i][1] - green) +
+	       (palette[i][2] - blue) * (palette[i][2] - blue);
+	if (best_dist > dist) {
+	    best_dist = dist;
+	    best = i;
+	}
+    }
+    return best;
+}
+
+
+/*
+ * nearest_by_green
+ *   DESCRIPTION: Find the palette color closest to a given color, as
+ *                nearest_color does, among palette colors listed in
+ *                order of green component.  The search starts from the
+ *                colors with green nearest the given color's and moves
+ *                outward in both directions, stopping on each side once
+ *                the difference in green alone is no closer than the
+ *                best color found.
+ *   INPUTS: palette -- the palette
+ *           order -- indices of the palette colors to consider, in
+ *                    nondecreasing order of green
+ *           n -- number of colors in order (at least one)
+ *           (red,green,blue) -- the color to match (6 bits each)
+ *   OUTPUTS: none
+ *   RETURN VALUE: index of the nearest palette color
+ *   SIDE EFFECTS: none
+ */
+static uint8_t
+nearest_by_green (uint8_t palette[QUANT_COLORS][3], const uint8_t* order,
+		  int n, int red, int green, int blue)
+{
+    int best;		/* index of closest palette color so far  */
+    int best_dist;	/* squared distance to closest color      */
+    int dist;		/* squared distance to current color      */
+    int lo;		/* next position to try below             */
+    int hi;		/* next position to try above             */
+    int mid;		/* bisection point                        */
+    const uint8_t* p;	/* palette color tried                    */
+
+    /* Find the first color with green no less than the given color's. */
+    for (lo = 0, hi = n; lo < hi; ) {
+	mid = (lo + hi) / 2;
+	if (palette[order[mid]][1] < green) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    hi = lo;
+    lo--;
+
+    best = order[n > hi ? hi : lo];
+    best_dist = 0x7FFFFFFF;
+    while (0 <= lo || n > hi) {
+	if (n > hi) {
+	    p = palette[order[hi]];
+	    if ((p[1] - green) * (p[1] - green) >= best_dist) {
+		hi = n;
+	    } else {
+		dist = (p[0] - red) * (p[0] - red) + 
+		       (p[1] - green) * (p[1] - green) +
+		       (p[2] - blue) * (p[2] - blue);
+		if (best_dist > dist) {
+		    best_dist = dist;
+		    best = order[hi];
+		}
+		hi++;
+	    }
+	}
+	if (0 <= lo) {
+	    p = palette[order[lo]];
+	    if ((p[1] - green) * (p[1] - green) >= best_dist) {
+		lo = -1;
+	    } else {
+		dist = (p[0] - red) * (p[0] - red) + 
+		       (p[1] - green) * (p[1] - green) +
+		       (p[2] - blue) * (p[2] - blue);
+		if (best_dist > dist) {
+		    best_dist = dist;
+		    best = order[lo];
+		}
+		lo--;
+	    }
+	}
+    }
+    return best;
+}
+
+
+/*
+ * quantize_histogram
+ *   DESCRIPTION: Choose palette colors by counting colors in a 4096-entry
+ *                (4:4:4) and a 64-entry (2:2:2) table.  The 128 most
+ *                common 4:4:4 colors plus the averages of whatever
+ *                remains in each 2:2:2 color become the palette.  Each
+ *                5:6:5 color in the photo then maps to the palette
+ *                color nearest to it.
+ *   INPUTS: pix -- 5:6:5 RGB pixels
+ *           n_pix -- number of pixels
+ *   OUTPUTS: palette -- the palette colors (6-bit RGB)
+ *            cmap -- VGA color for each 5:6:5 color
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quantize_histogram (const uint16_t* pix, uint32_t n_pix,
+		    uint8_t palette[QUANT_COLORS][3], uint8_t* cmap)
+{
+    octree_arr_t* level_two;	/* 2:2:2 color counts and sums        */
+    octree_arr_t* level_four;	/* 4:4:4 color counts and sums        */
+    color_count_t* colors;	/* distinct colors in photo           */
+    uint32_t      n_colors;	/* number of distinct colors          */
+    uint8_t       used[QUANT_COLORS]; /* palette colors with pixels   */
+    uint8_t       order[QUANT_COLORS]; /* used colors by green        */
+    int           n_order;	/* number of used colors              */
+    int           g;		/* index over green components        */
+    uint32_t      idx;		/* index over distinct colors         */
+    uint16_t      c;		/* a distinct color                   */
+    int           bin;		/* 4:4:4 bin of a distinct color      */
+    int           i;		/* index over bins                    */
+    int           two_index;	/* 2:2:2 bin of a 4:4:4 bin           */
+
+    if (NULL == (level_two = scratch_zalloc (64 * sizeof (level_two[0]))) ||
+	NULL == (level_four = scratch_zalloc (4096 * sizeof (level_four[0]))) ||
+	NULL == (colors = count_colors (pix, n_pix, &n_colors))) {
+	return -1;
+    }
+
+    /*
+     * Count colors.  The 2:2:2 and 4:4:4 colors keep the most significant
+     * bits of each component.  Each distinct 5:6:5 color is added to its
+     * 4:4:4 bin with its pixel count, which is faster than adding pixels
+     * one by one (even with SSE2 or AVX2 to decode them), since photos
+     * repeat colors heavily.  Each 2:2:2 bin is then the sum of the 64
+     * 4:4:4 bins inside it.
+     */
+    for (idx = 0; n_colors > idx; idx++) {
+	c = colors[idx].color;
+	bin = BIN_444 (c);
+	level_four[bin].red += colors[idx].count * ((c >> 11) & 0x1F);
+	level_four[bin].green += colors[idx].count * ((c >> 5) & 0x3F);
+	level_four[bin].blue += colors[idx].count * (c & 0x1F);
+	level_four[bin].counter += colors[idx].count;
+    }
+    for (i = 0; 4096 > i; i++) {
+	level_four[i].index = i;
+	two_index = BIN_222 (i);
+	level_two[two_index].red += level_four[i].red;
+	level_two[two_index].green += level_four[i].green;
+	level_two[two_index].blue += level_four[i].blue;
+	level_two[two_index].counter += level_four[i].counter;
+    }
+
+    /* Put the most common 4:4:4 colors first. */
+    qsort (level_four, 4096, sizeof (level_four[0]), compare_bin_counts);
+
+    /*
+     * Pixels in the 128 most common 4:4:4 colors are represented by
+     * those colors, so take them out of the 2:2:2 color averages.  The
+     * 2:2:2 colors then represent whatever remains.
+     */
+    for (i = 0; 128 > i && 0 != level_four[i].counter; i++) {
+	two_index = BIN_222 (level_four[i].index);
+	level_two[two_index].red -= level_four[i].red;
+	level_two[two_index].green -= level_four[i].green;
+	level_two[two_index].blue -= level_four[i].blue;
+	level_two[two_index].counter -= level_four[i].counter;
+    }
+
+    /*
+     * Fill the palette with the average of the pixels represented by
+     * each color.  The 2:2:2 colors follow the 128 4:4:4 colors.  Colors
+     * that represent no pixels are left black.
+     */
+    for (i = 0; 128 > i; i++) {
+	if ((used[i] = (0 != level_four[i].counter))) {
+	    palette[i][0] = (level_four[i].red / level_four[i].counter) << 1;
+	    palette[i][1] = (level_four[i].green / level_four[i].counter);
+	    palette[i][2] = (level_four[i].blue / level_four[i].counter) << 1;
+	}
+    }
+    for (i = 0; 64 > i; i++) {
+	if ((used[i + 128] = (0 != level_two[i].counter))) {
+	    palette[i + 128][0] =
+		    (level_two[i].red / level_two[i].counter) << 1;
+	    palette[i + 128][1] =
+		    (level_two[i].green / level_two[i].counter);
+	    palette[i + 128][2] =
+		    (level_two[i].blue / level_two[i].counter) << 1;
+	}
+    }
+
+    /* List the palette colors that represent pixels in order of green. */
+    n_order = 0;
+    for (g = 0; 64 > g; g++) {
+	for (i = 0; QUANT_COLORS > i; i++) {
+	    if (used[i] && g == palette[i][1]) {
+		order[n_order++] = i;
+	    }
+	}
+    }
+
+    /*
+     * Map each distinct 5:6:5 color to the palette color nearest to it.
+     * A color in one of the 128 most common 4:4:4 colors usually maps
+     * to that color's average, but not always.
+     */
+    for (idx = 0; n_colors > idx; idx++) {
+	c = colors[idx].color;
+	cmap[c] = QUANT_FIRST_COLOR + 
+		  nearest_by_green (palette, order, n_order, RED6 (c),
+				    GREEN6 (c), BLUE6 (c));
+    }
+
+    return 0;
+}
+
+
+/*
+ * quantize_octree
+ *   DESCRIPTION: Choose palette colors by building an octree over the
+ *                photo's distinct colors (one level per bit of each
+ *                component, most significant first), then pruning it:
+ *                starting at the deepest level, the nodes with the
+ *                fewest pixels absorb their children until no more than
+ *                QUANT_COLORS leaves remain.  Each leaf's average color
+ *                becomes a palette color.
+ *   INPUTS: pix -- 5:6:5 RGB pixels
+ *           n_pix -- number of pixels
+ *   OUTPUTS: palette -- the palette colors (6-bit RGB)
+ *            cmap -- VGA color for each 5:6:5 color in the photo
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quantize_octree (const uint16_t* pix, uint32_t n_pix,
+		 uint8_t palette[QUANT_COLORS][3], uint8_t* cmap)
+{
+    color_count_t* colors;	/* distinct colors in photo            */
+    uint32_t       n_colors;	/* number of distinct colors           */
+    oct_node_t*    node;	/* octree nodes (0 is the root)        */
+    int32_t        n_nodes;	/* number of nodes in use              */
+    int32_t        max_nodes;	/* number of nodes allocated           */
+    oct_rank_t*    order;	/* internal nodes of one level         */
+    int32_t        n_order;	/* number of nodes in order            */
+    int32_t        n_leaves;	/* number of leaves in the tree        */
+    int32_t        cur;		/* node being visited                  */
+    int32_t        level;	/* index over tree levels              */
+    int32_t        c;		/* index over children                 */
+    int32_t        i;		/* index over nodes                    */
+    uint32_t       idx;		/* index over distinct colors          */
+    uint32_t       width;	/* most nodes possible at one level    */
+    int            red;		/* components of current color         */
+    int            green;
+    int            blue;
+    int            n_pal;	/* palette colors assigned             */
+
+    if (NULL == (colors = count_colors (pix, n_pix, &n_colors))) {
+	return -1;
+    }
+
+    /* Each level holds at most 8^level nodes and at most one per color. */
+    for (max_nodes = 0, level = 0, width = 1; OCT_DEPTH >= level;
+	 level++, width *= 8) {
+	max_nodes += (width < n_colors ? width : n_colors);
+    }
+    if (NULL == (node = scratch_alloc (max_nodes * sizeof (node[0]))) ||
+	NULL == (order = scratch_alloc (max_nodes * sizeof (order[0])))) {
+	return -1;
+    }
+    (void)memset (&node[0], 0, sizeof (node[0]));
+    (void)memset (node[0].child, 0xFF, sizeof (node[0].child));
+    n_nodes = 1;
+    n_leaves = 0;
+
+    /*
+     * Insert each distinct color, adding its pixels to every node on
+     * the path down to its leaf.
+     */
+    for (idx = 0; n_colors > idx; idx++) {
+	red = (colors[idx].color >> 11) & 0x1F;
+	green = (colors[idx].color >> 6) & 0x1F;
+	blue = colors[idx].color & 0x1F;
+	for (cur = 0, level = 0; ; level++) {
+	    node[cur].count += colors[idx].count;
+	    node[cur].red += colors[idx].count * RED6 (colors[idx].color);
+	    node[cur].green += colors[idx].count * GREEN6 (colors[idx].color);
+	    node[cur].blue += colors[idx].count * BLUE6 (colors[idx].color);
+	    if (OCT_DEPTH == level) {
+		break;
+	    }
+	    c = ((red >> (4 - level)) & 1) << 2 |
+		((green >> (4 - level)) & 1) << 1 |
+		((blue >> (4 - level)) & 1);
+	    if (-1 == node[cur].child[c]) {
+		(void)memset (&node[n_nodes], 0, sizeof (node[0]));
+		(void)memset (node[n_nodes].child, 0xFF,
+			      sizeof (node[0].child));
+		node[n_nodes].level = level + 1;
+		node[cur].child[c] = n_nodes++;
+	    }
+	    cur = node[cur].child[c];
+	}
+	if (!node[cur].leaf) {
+	    node[cur].leaf = 1;
+	    n_leaves++;
+	}
+    }
+
+    /*
+     * Prune from the deepest internal level upward.  When a level is
+     * reached, every deeper node has already been folded into its parent,
+     * so all children of the nodes at this level are leaves.  Nodes with
+     * fewer pixels are folded first.
+     */
+    for (level = OCT_DEPTH - 1; 0 <= level && QUANT_COLORS < n_leaves;
+	 level--) {
+	for (i = n_order = 0; n_nodes > i; i++) {
+	    if (level == node[i].level && !node[i].leaf) {
+		order[n_order].count = node[i].count;
+		order[n_order].node = i;
+		n_order++;
+	    }
+	}
+	/* A level can hold thousands of nodes, so sort with qsort. */
+	qsort (order, n_order, sizeof (order[0]), compare_node_counts);
+	for (i = 0; n_order > i && QUANT_COLORS < n_leaves; i++) {
+	    cur = order[i].node;
+	    for (c = 0; 8 > c; c++) {
+		if (-1 != node[cur].child[c]) {
+		    node[node[cur].child[c]].leaf = 0;
+		    node[cur].child[c] = -1;
+		    n_leaves--;
+		}
+	    }
+	    node[cur].leaf = 1;
+	    n_leaves++;
+	}
+    }
+
+    /* Each remaining leaf's average color becomes a palette color. */
+    for (i = n_pal = 0; n_nodes > i; i++) {
+	if (node[i].leaf && 0 != node[i].count) {
+	    node[i].color = n_pal;
+	    palette[n_pal][0] = node[i].red / node[i].count;
+	    palette[n_pal][1] = node[i].green / node[i].count;
+	    palette[n_pal][2] = node[i].blue / node[i].count;
+	    n_pal++;
+	}
+    }
+
+    /* Each color maps to the leaf found by walking down the tree. */
+    for (idx = 0; n_colors > idx; idx++) {
+	red = (colors[idx].color >> 11) & 0x1F;
+	green = (colors[idx].color >> 6) & 0x1F;
+	blue = colors[idx].color & 0x1F;
+	for (cur = 0, level = 0; !node[cur].leaf; level++) {
+	    c = ((red >> (4 - level)) & 1) << 2 |
+		((green >> (4 - level)) & 1) << 1 |
+		((blue >> (4 - level)) & 1);
+	    cur = node[cur].child[c];
+	}
+	cmap[colors[idx].color] = node[cur].color + QUANT_FIRST_COLOR;
+    }
+
+    return 0;
+}
+
+
+/*
+ * measure_box
+ *   DESCRIPTION: Find the number of pixels in a median cut box and the
+ *                component with the greatest range of values.
+ *   INPUTS: colors -- list of distinct colors
+ *           box -- the box (first and n must be set)
+ *   OUTPUTS: box -- count, axis, and range are filled in
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+measure_box (const color_count_t* colors, cut_box_t* box)
+{
+    int      lo[3] = {63, 63, 63};	/* smallest component values */
+    int      hi[3] = {0, 0, 0};		/* largest component values  */
+    int      val[3];			/* components of one color   */
+    int      a;				/* index over components     */
+    uint32_t idx;			/* index over colors in box  */
+
+    box->count = 0;
+    for (idx = box->first; box->first + box->n > idx; idx++) {
+	box->count += colors[idx].count;
+	val[0] = RED6 (colors[idx].color);
+	val[1] = GREEN6 (colors[idx].color);
+	val[2] = BLUE6 (colors[idx].color);
+	for (a = 0; 3 > a; a++) {
+	    if (lo[a] > val[a]) {
+		lo[a] = val[a];
+	    }
+	    if (hi[a] < val[a]) {
+		hi[a] = val[a];
+	    }
+	}
+    }
+    box->axis = 0;
+    for (a = 1; 3 > a; a++) {
+	if (hi[a] - lo[a] > hi[box->axis] - lo[box->axis]) {
+	    box->axis = a;
+	}
+    }
+    box->range = hi[box->axis] - lo[box->axis];
+}
+
+
+/*
+ * median_cut
+ *   DESCRIPTION: Choose palette colors by median cut from a photo's
+ *                distinct colors.  All colors start in one box.  The box
+ *                with the largest product of pixel count and longest
+ *                side is repeatedly split at the pixel median of that
+ *                side until there are QUANT_COLORS boxes or none can be
+ *                split.  Each box's average color becomes a palette
+ *                color.
+ *   INPUTS: colors -- distinct colors in the photo (see count_colors)
+ *           n_colors -- number of distinct colors
+ *   OUTPUTS: colors -- reordered
+ *            palette -- the palette colors (6-bit RGB)
+ *            cmap -- VGA color for each 5:6:5 color in the photo
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+median_cut (color_count_t* colors, uint32_t n_colors,
+	    uint8_t palette[QUANT_COLORS][3], uint8_t* cmap)
+{
+    static int (* const compare_axis[3]) (const void*, const void*) = {
+	compare_red, compare_green, compare_blue
+    };
+    cut_box_t      box[QUANT_COLORS]; /* boxes of colors               */
+    int32_t        n_boxes;	/* number of boxes                     */
+    int32_t        best;	/* box to split next                   */
+    int32_t        b;		/* index over boxes                    */
+    uint32_t       half;	/* pixels in lower part of split box   */
+    uint32_t       split;	/* colors in lower part of split box   */
+    uint32_t       idx;		/* index over colors                   */
+    uint32_t       red;		/* sums of components in a box         */
+    uint32_t       green;
+    uint32_t       blue;
+
+    box[0].first = 0;
+    box[0].n = n_colors;
+    measure_box (colors, &box[0]);
+    n_boxes = 1;
+
+    while (QUANT_COLORS > n_boxes) {
+
+	/* Find the box to split. */
+	for (best = -1, b = 0; n_boxes > b; b++) {
+	    if (1 < box[b].n &&
+		(-1 == best || (uint64_t)box[b].count * box[b].range >
+			       (uint64_t)box[best].count * box[best].range)) {
+		best = b;
+	    }
+	}
+	if (-1 == best) {
+	    break;
+	}
+
+	/* Sort its colors along its longest side and split at the median. */
+	qsort (colors + box[best].first, box[best].n, sizeof (colors[0]),
+	       compare_axis[box[best].axis]);
+	half = colors[box[best].first].count;
+	for (split = 1; box[best].n - 1 > split &&
+		        half + colors[box[best].first + split].count <=
+			    box[best].count / 2; split++) {
+	    half += colors[box[best].first + split].count;
+	}
+	box[n_boxes].first = box[best].first + split;
+	box[n_boxes].n = box[best].n - split;
+	box[best].n = split;
+	measure_box (colors, &box[best]);
+	measure_box (colors, &box[n_boxes]);
+	n_boxes++;
+    }
+
+    /* Each box's average color becomes a palette color. */
+    for (b = 0; n_boxes > b; b++) {
+	red = green = blue = 0;
+	for (idx = box[b].first; box[b].first + box[b].n > idx; idx++) {
+	    red += colors[idx].count * RED6 (colors[idx].color);
+	    green += colors[idx].count * GREEN6 (colors[idx].color);
+	    blue += colors[idx].count * BLUE6 (colors[idx].color);
+	    cmap[colors[idx].color] = b + QUANT_FIRST_COLOR;
+	}
+	if (0 != box[b].count) {
+	    palette[b][0] = red / box[b].count;
+	    palette[b][1] = green / box[b].count;
+	    palette[b][2] = blue / box[b].count;
+	}
+    }
+}
+
+
+/*
+ * quantize_median_cut
+ *   DESCRIPTION: Choose palette colors by median cut (see median_cut).
+ *   INPUTS: pix -- 5:6:5 RGB pixels
+ *           n_pix -- number of pixels
+ *   OUTPUTS: palette -- the palette colors (6-bit RGB)
+ *            cmap -- VGA color for each 5:6:5 color in the photo
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quantize_median_cut (const uint16_t* pix, uint32_t n_pix,
+		     uint8_t palette[QUANT_COLORS][3], uint8_t* cmap)
+{
+    color_count_t* colors;	/* distinct colors in photo  */
+    uint32_t       n_colors;	/* number of distinct colors */
+
+    if (NULL == (colors = count_colors (pix, n_pix, &n_colors))) {
+	return -1;
+    }
+    median_cut (colors, n_colors, palette, cmap);
+    return 0;
+}
+
+
+/*
+ * quantize_kmeans
+ *   DESCRIPTION: Choose palette colors with median cut, then refine them
+ *                with up to QUANT_KMEANS_ROUNDS rounds of k-means: each
+ *                distinct color moves to its nearest palette color, and
+ *                each palette color moves to the average of its pixels.
+ *                Stops early once no color changes palette color.
+ *   INPUTS: pix -- 5:6:5 RGB pixels
+ *           n_pix -- number of pixels
+ *   OUTPUTS: palette -- the palette colors (6-bit RGB)
+ *            cmap -- VGA color for each 5:6:5 color in the photo
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quantize_kmeans (const uint16_t* pix, uint32_t n_pix,
+		 uint8_t palette[QUANT_COLORS][3], uint8_t* cmap)
+{
+    color_count_t* colors;	/* distinct colors in photo            */
+    uint32_t       n_colors;	/* number of distinct colors           */
+    uint32_t       sum[QUANT_COLORS][4]; /* component sums and counts  */
+    uint32_t       idx;		/* index over colors                   */
+    int32_t        round;	/* index over k-means rounds           */
+    int32_t        changed;	/* colors that moved this round        */
+    uint8_t        k;		/* palette color nearest a color       */
+    int            i;		/* index over palette colors           */
+
+    if (NULL == (colors = count_colors (pix, n_pix, &n_colors))) {
+	return -1;
+    }
+    median_cut (colors, n_colors, palette, cmap);
+
+    for (round = 0; QUANT_KMEANS_ROUNDS > round; round++) {
+	(void)memset (sum, 0, sizeof (sum));
+	changed = 0;
+	for (idx = 0; n_colors > idx; idx++) {
+	    k = nearest_color (palette, NULL, RED6 (colors[idx].color),
+			       GREEN6 (colors[idx].color),
+			       BLUE6 (colors[idx].color));
+	    if (k + QUANT_FIRST_COLOR != cmap[colors[idx].color]) {
+		cmap[colors[idx].color] = k + QUANT_FIRST_COLOR;
+		changed++;
+	    }
+	    sum[k][0] += colors[idx].count * RED6 (colors[idx].color);
+	    sum[k][1] += colors[idx].count * GREEN6 (colors[idx].color);
+	    sum[k][2] += colors[idx].count * BLUE6 (colors[idx].color);
+	    sum[k][3] += colors[idx].count;
+	}
+	if (0 == changed && 0 != round) {
+	    break;
+	}
+	for (i = 0; QUANT_COLORS > i; i++) {
+	    if (0 != sum[i][3]) {
+		palette[i][0] = (sum[i][0] + sum[i][3] / 2) / sum[i][3];
+		palette[i][1] = (sum[i][1] + sum[i][3] / 2) / sum[i][3];
+		palette[i][2] = (sum[i][2] + sum[i][3] / 2) / sum[i][3];
+	    }
+	}
+    }
+
+    return 0;
+}
+
+
+/*
+ * make_scratch_key
+ *   DESCRIPTION: Create the key for per-thread scratch arenas.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: creates scratch_key (called once, via pthread_once)
+ */
+static void
+make_scratch_key ()
+{
+    (void)pthread_key_create (&scratch_key, free_scratch);
+}
+
+
+/*
+ * free_scratch
+ *   DESCRIPTION: Free a thread's scratch arena when the thread exits.
+ *   INPUTS: arena -- the arena
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the arena and its slabs
+ */
+static void
+free_scratch (void* arena)
+{
+    arena_release (arena);
+    free (arena);
+}
+
+
+/*
+ * get_scratch
+ *   DESCRIPTION: Find the calling thread's scratch arena, creating it
+ *                on first use.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the arena, or NULL on failure
+ *   SIDE EFFECTS: may allocate the arena
+ */
+static arena_t*
+get_scratch ()
+{
+    static const arena_t empty = ARENA_INIT (ARENA_SLAB_SIZE);
+    arena_t* a;	/* the thread's arena */
+
+    (void)pthread_once (&scratch_once, make_scratch_key);
+    if (NULL == (a = pthread_getspecific (scratch_key))) {
+	if (NULL == (a = malloc (sizeof (*a)))) {
+	    return NULL;
+	}
+	*a = empty;
+	if (0 != pthread_setspecific (scratch_key, a)) {
+	    free (a);
+	    return NULL;
+	}
+    }
+    return a;
+}
+
+
+/*
+ * scratch_alloc
+ *   DESCRIPTION: Allocate cache-line aligned scratch memory that lasts
+ *                until the calling thread next starts quantize.
+ *   INPUTS: size -- bytes needed
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the memory, or NULL on failure
+ *   SIDE EFFECTS: allocates from the thread's scratch arena
+ */
+static void*
+scratch_alloc (size_t size)
+{
+    arena_t* a;	/* the thread's arena */
+
+    if (NULL == (a = get_scratch ())) {
+	return NULL;
+    }
+    return arena_alloc (a, size, ARENA_LINE);
+}
+
+
+/*
+ * scratch_zalloc
+ *   DESCRIPTION: Allocate zeroed scratch memory (see scratch_alloc).
+ *   INPUTS: size -- bytes needed
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the memory, or NULL on failure
+ *   SIDE EFFECTS: allocates from the thread's scratch arena
+ */
+static void*
+scratch_zalloc (size_t size)
+{
+    void* mem;	/* the memory */
+
+    if (NULL != (mem = scratch_alloc (size))) {
+	(void)memset (mem, 0, size);
+    }
+    return mem;
+}
@@ -0,0 +1,77 @@
+/*									tab:8
+ *
+ * quantize.h - room photo color quantization header file
+ *
+ * Filename:	    quantize.h
+ * History:
+ *	1	Palette selection split out of photo.c behind a common
+ *		interface, with octree, median-cut, and k-means methods
+ *		added alongside the original histogram method.
+ */
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+
+#include <stdint.h>
+
+
+/*
+ * Room photos use the upper 192 VGA colors; the lower 64 hold the fixed
+ * 2:2:2 palette used by object images and the status bar.
+ */
+#define QUANT_COLORS      192	/* palette colors chosen per photo    */
+#define QUANT_FIRST_COLOR 64	/* VGA color of first palette entry   */
+
+/* palette selection methods */
+typedef enum {
+    QUANT_HISTOGRAM,	/* 128 most common 4:4:4 colors plus 2:2:2 colors */
+    QUANT_OCTREE,	/* octree pruned back to QUANT_COLORS leaves      */
+    QUANT_MEDIAN_CUT,	/* boxes split at the median of the longest side  */
+    QUANT_KMEANS,	/* median cut refined by a few k-means rounds     */
+    NUM_QUANT_METHODS
+} quant_method_t;
+
+/*
+ * The method used unless another is selected at run time; override
+ * with -DQUANT_DEFAULT_METHOD=QUANT_OCTREE (etc.) when compiling.
+ */
+#if !defined(QUANT_DEFAULT_METHOD)
+#define QUANT_DEFAULT_METHOD QUANT_HISTOGRAM
+#endif
+
+/* upper bound on rounds of k-means refinement */
+#if !defined(QUANT_KMEANS_ROUNDS)
+#define QUANT_KMEANS_ROUNDS 6
+#endif
+
+
+/*
+ * Choose a palette for n_pix 5:6:5 RGB pixels and map each pixel to it.
+ * The palette holds 6-bit RGB components; out receives one VGA color
+ * (QUANT_FIRST_COLOR and up) per pixel.  Returns 0 on success, or -1
+ * if memory could not be allocated.  Safe to call from several threads
+ * at once.
+ */
+extern int32_t quantize (const uint16_t* pix, uint32_t n_pix,
+			 uint8_t palette[QUANT_COLORS][3], uint8_t* out);
+
+/* Get the palette selection method currently in use. */
+extern quant_method_t quantize_get_method (void);
+
+/*
+ * Select the palette selection method by name ("histogram", "octree",
+ * "mediancut", or "kmeans").  Returns 0 on success, or -1 if the name
+ * is not recognized.
+ */
+extern int32_t quantize_set_method (const char* name);
+
+/* Get the name of a palette selection method. */
+extern const char* quantize_method_name (quant_method_t m);
+
+/*
+ * Get the version of a palette selection method, which changes whenever
+ * the method's output for a photo changes.
+ */
+extern uint32_t quantize_method_version (quant_method_t m);
+
+#endif /* QUANTIZE_H */
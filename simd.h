@@ -0,0 +1,34 @@
+/*									tab:8
+ *
+ * simd.h - detection of x86 vector instructions, header file
+ *
+ * Filename:	    simd.h
+ * History:
+ *	1	First written.
+ */
+#ifndef SIMD_H
+#define SIMD_H
+
+
+/*
+ * Kernels written with SSE2 or AVX2 intrinsics are compiled only when
+ * HAVE_X86_SIMD is 1, that is, for x86 with a GCC-compatible compiler.
+ * Each kernel carries its own target attribute, so the rest of the
+ * program need not be compiled for those instructions.  Whether the
+ * processor running the program has them is checked at run time with
+ * SIMD_HAS_SSE2 and SIMD_HAS_AVX2 before a kernel is chosen.  Files that
+ * use these kernels also have a switch of their own (for example,
+ * PHOTO_USE_SIMD) to force the plain C versions.
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#define SIMD_HAS_SSE2() __builtin_cpu_supports ("sse2")
+#define SIMD_HAS_AVX2() __builtin_cpu_supports ("avx2")
+#else
+#define HAVE_X86_SIMD 0
+#define SIMD_HAS_SSE2() 0
+#define SIMD_HAS_AVX2() 0
+#endif
+
+#endif /* SIMD_H */
@@ -38,6 +38,9 @@
 typedef struct photo_t photo_t;
 typedef struct image_t image_t;
 
+/* types defined in photo_store.c */
+typedef struct photo_slot_t photo_slot_t;
+
 /* types defined in world.h */
 typedef struct room_t room_t;
 typedef struct object_t object_t;
@@ -34,11 +34,14 @@
  */
  
 
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
 #include "assert.h"
+#include "parallel.h"
 #include "photo.h"
+#include "photo_store.h"
 #include "world.h"
 
 
@@ -170,20 +173,47 @@ enum {
     N_SWAPS
 };
 
+/* 
+ * images read by build_world, in data order: room photos, object images,
+ * and then swap photos 
+ */
+#define N_IMAGES (N_ROOMS + N_OBJECTS + N_SWAPS)
+
 
 /* types local to this file (declared in types.h) */
 
+/*
+ * An index of the objects in a room along one axis of the room photo,
+ * so that drawing a line of the screen need only look at objects near
+ * the line.  The axis is cut into bands of OBJ_BAND_SIZE pixels (see
+ * world.h), and each band lists the objects that overlap it, in the
+ * order in which they are drawn (the order of the room's contents).  An
+ * object appears in every band it overlaps.  The index is rebuilt
+ * whenever an object enters or leaves the room; if it cannot be
+ * allocated, the room is left unindexed and every line is drawn from
+ * all of the room's objects.
+ */
+typedef struct obj_index_t obj_index_t;
+struct obj_index_t {
+    int32_t    n_bands;	/* number of bands holding objects         */
+    uint32_t*  first;	/* index in objs of first object in each    */
+			/*   band, then of the end of the last band */
+    object_t** objs;	/* objects overlapping each band            */
+};
+
 /*
  * The structure representing a room in the world.  The backpack/inventory 
  * is also a 'room' (#0, R_INVENTORY). 
  */
 struct room_t {
     const char* name;		/* name of room                   */
-    photo_t*    view;		/* photo currently shown for room */
+    photo_slot_t* view;		/* photo currently shown for room */
     object_t*   contents; 	/* linked list of objects in room */
     room_t*     left;   	/* room to the "left"             */
     room_t*     enter;  	/* doors, etc.                    */
     room_t*     right;  	/* room to the "right"            */
+    obj_index_t rows;		/* objects by row of room photo   */
+    obj_index_t cols;		/* objects by column of room photo */
 };
 
 /*
@@ -425,9 +455,13 @@ static const swap_data_t swap_data[N_SWAPS] = {
 /* functions local to this file--see function headers for details */
 static void do_photo_swap (room_t* r, int32_t which);
 static object_t* find_in_room (const room_t* r, const char* arg);
+static void index_objects (obj_index_t* idx, const room_t* r, int32_t cols);
 static void insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y);
 static void insert_object (object_t* o, room_t* r);
+static void load_image (void* arg, int32_t idx);
 static void move_object_to_inventory (object_t* obj);
+static void obj_bands (const object_t* o, int32_t cols, int32_t* lo, 
+		       int32_t* hi);
 static object_t* obj_special_get (room_t* r, const char* arg);
 static int32_t player_flag_is_set (int32_t fnum);
 static void player_set_flag (int32_t fnum);
@@ -443,7 +477,8 @@ static void remove_object (object_t* o);
 static room_t   room[N_ROOMS];			     /* rooms                */
 static object_t object[N_OBJECTS];		     /* objects              */
 static uint32_t player_flags[(NUM_FLAGS + 31) / 32]; /* accomplishment flags */
-static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
+static photo_slot_t* swap_photo[N_SWAPS];            /* swapping photos      */
+static int32_t  load_threads = LOAD_THREADS;         /* build_world threads  */
 
 
 /* 
@@ -458,12 +493,13 @@ static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
 static void
 do_photo_swap (room_t* r, int32_t which)
 {
-    photo_t* tmp;	/* temporary variable to help with swap */
+    photo_slot_t* tmp;	/* temporary variable to help with swap */
 
     /* Swap the photos. */
     tmp               = r->view;
     r->view           = swap_photo[which];
     swap_photo[which] = tmp;
+    room_photo_swapped (r);
 }
 
 
@@ -496,6 +532,105 @@ find_in_room (const room_t* r, const char* arg)
 }
 
 
+/* 
+ * obj_bands
+ *   DESCRIPTION: Find the bands of a room's object index (see 
+ *                obj_index_t) that an object overlaps.
+ *   INPUTS: o -- the object
+ *           cols -- 1 for bands of columns, or 0 for bands of rows
+ *   OUTPUTS: lo -- first band overlapped
+ *            hi -- last band overlapped
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+obj_bands (const object_t* o, int32_t cols, int32_t* lo, int32_t* hi)
+{
+    if (cols) {
+	*lo = o->x >> OBJ_BAND_SHIFT;
+	*hi = (o->x + image_width (o->img) - 1) >> OBJ_BAND_SHIFT;
+    } else {
+	*lo = o->y >> OBJ_BAND_SHIFT;
+	*hi = (o->y + image_height (o->img) - 1) >> OBJ_BAND_SHIFT;
+    }
+}
+
+
+/* 
+ * index_objects
+ *   DESCRIPTION: Rebuild one of the object indices of a room (see
+ *                obj_index_t) from the room's contents.
+ *   INPUTS: r -- the room
+ *           cols -- 1 to index by column, or 0 to index by row
+ *   OUTPUTS: idx -- the index
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: dynamically allocates memory for the index; if out of
+ *                 memory, leaves the room unindexed, so that all of its
+ *                 objects are drawn on every line
+ */
+static void
+index_objects (obj_index_t* idx, const room_t* r, int32_t cols)
+{
+    object_t* o;	/* loop index over room contents   */
+    int32_t   lo;	/* first band overlapped by object */
+    int32_t   hi;	/* last band overlapped by object  */
+    int32_t   b;	/* loop index over bands           */
+    int32_t   n_bands;	/* bands needed                    */
+    uint32_t  n_objs;	/* total entries in all bands      */
+
+    /* Count the bands and entries needed. */
+    n_bands = 0;
+    n_objs = 0;
+    for (o = r->contents; NULL != o; o = o->next) {
+	obj_bands (o, cols, &lo, &hi);
+	if (n_bands <= hi) {
+	    n_bands = hi + 1;
+	}
+	n_objs += hi - lo + 1;
+    }
+
+    /* Replace the old index. */
+    free (idx->objs);
+    idx->objs = NULL;
+    idx->first = NULL;
+    idx->n_bands = 0;
+    if (0 == n_objs) {
+	return;
+    }
+    if (NULL == (idx->objs = malloc (n_objs * sizeof (idx->objs[0]) +
+				     (n_bands + 1) * sizeof (idx->first[0])))) {
+	return;
+    }
+    idx->first = (uint32_t*)(idx->objs + n_objs);
+    idx->n_bands = n_bands;
+
+    /* 
+     * Count the objects in each band and turn the counts into the index
+     * of the start of each band.  Then fill the bands in drawing order,
+     * advancing each band's start as it fills, so that it ends up at the
+     * start of the next band; shift the starts back into place.
+     */
+    (void)memset (idx->first, 0, (n_bands + 1) * sizeof (idx->first[0]));
+    for (o = r->contents; NULL != o; o = o->next) {
+	for (obj_bands (o, cols, &lo, &hi); hi >= lo; lo++) {
+	    idx->first[lo + 1]++;
+	}
+    }
+    for (b = 0; n_bands > b; b++) {
+	idx->first[b + 1] += idx->first[b];
+    }
+    for (o = r->contents; NULL != o; o = o->next) {
+	for (obj_bands (o, cols, &lo, &hi); hi >= lo; lo++) {
+	    idx->objs[idx->first[lo]++] = o;
+	}
+    }
+    for (b = n_bands; 0 < b; b--) {
+	idx->first[b] = idx->first[b - 1];
+    }
+    idx->first[0] = 0;
+}
+
+
 /* 
  * insert_object_at
  *   DESCRIPTION: Place an object at a specific (x,y) location in a room.
@@ -523,6 +658,10 @@ insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
     o->loc = r;
     o->next = r->contents;
     r->contents = o;
+    index_objects (&r->rows, r, 0);
+    index_objects (&r->cols, r, 1);
+    room_objects_moved (r, x, y, image_width (o->img), 
+			image_height (o->img));
 }
 
 
@@ -548,11 +687,11 @@ insert_object (object_t* o, room_t* r)
 
 
     /* Choose a random x location. */
-    range = photo_width (r->view) - image_width (o->img);
+    range = photo_slot_width (r->view) - image_width (o->img);
     xpos = (0 >= range ? 0 : (rand () % range));
 
     /* Place in the lowest quarter of the roo photo if the object fits... */
-    space = photo_height (r->view);
+    space = photo_slot_height (r->view);
     img_ht = image_height (o->img);
     range = space / 4 - img_ht;
     if (0 >= range) {
@@ -707,6 +846,11 @@ remove_object (object_t* o)
 	    }
 	}
 
+	index_objects (&o->loc->rows, o->loc, 0);
+	index_objects (&o->loc->cols, o->loc, 1);
+	room_objects_moved (o->loc, o->x, o->y, image_width (o->img), 
+			    image_height (o->img));
+
 	/* Mark the object's location as NULL. */
 	o->loc = NULL;
     }
@@ -791,6 +935,64 @@ room_contents_iterate (const room_t* r)
 }
 
 
+/* 
+ * room_objects_on_row
+ *   DESCRIPTION: Get the objects in a room that may overlap a row of the
+ *                room photo, in the order in which they are drawn.  Some
+ *                may not in fact overlap the row.
+ *   INPUTS: r -- pointer to the room
+ *           y -- the row
+ *   OUTPUTS: objs -- set to point to the first object
+ *   RETURN VALUE: the number of objects, or -1 if the room's objects
+ *                 could not be indexed, in which case the caller must
+ *                 walk all of the room's contents instead
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_objects_on_row (const room_t* r, int32_t y, object_t* const** objs)
+{
+    const obj_index_t* idx = &r->rows; /* the index */
+
+    if (NULL == idx->objs && NULL != r->contents) {
+	return -1;
+    }
+    if (0 > y || idx->n_bands <= (y >>= OBJ_BAND_SHIFT)) {
+	return 0;
+    }
+    *objs = idx->objs + idx->first[y];
+    return idx->first[y + 1] - idx->first[y];
+}
+
+
+/* 
+ * room_objects_on_column
+ *   DESCRIPTION: Get the objects in a room that may overlap a column of
+ *                the room photo, in the order in which they are drawn.
+ *                Some may not in fact overlap the column.
+ *   INPUTS: r -- pointer to the room
+ *           x -- the column
+ *   OUTPUTS: objs -- set to point to the first object
+ *   RETURN VALUE: the number of objects, or -1 if the room's objects
+ *                 could not be indexed, in which case the caller must
+ *                 walk all of the room's contents instead
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_objects_on_column (const room_t* r, int32_t x, object_t* const** objs)
+{
+    const obj_index_t* idx = &r->cols; /* the index */
+
+    if (NULL == idx->objs && NULL != r->contents) {
+	return -1;
+    }
+    if (0 > x || idx->n_bands <= (x >>= OBJ_BAND_SHIFT)) {
+	return 0;
+    }
+    *objs = idx->objs + idx->first[x];
+    return idx->first[x + 1] - idx->first[x];
+}
+
+
 /* 
  * room_name
  *   DESCRIPTION: Get name for a room.
@@ -808,16 +1010,24 @@ room_name (const room_t* r)
 
 /* 
  * room_photo
- *   DESCRIPTION: Get room photo for a room.
+ *   DESCRIPTION: Get room photo for a room, reading it if it is not
+ *                resident.  The photo stays valid until the photo of
+ *                another room is requested.
  *   INPUTS: r -- pointer to the room
  *   OUTPUTS: none
  *   RETURN VALUE: a pointer to room r's photo
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may read room r's photo and free others; terminates
+ *                 the program if the photo can't be read
  */
 photo_t*
 room_photo (const room_t* r)
 {
-    return r->view;
+    photo_t* p;	/* room r's photo */
+
+    if (NULL == (p = photo_slot_get (r->view))) {
+	PANIC ("can't read room photo");
+    }
+    return p;
 }
 
 
@@ -832,7 +1042,7 @@ room_photo (const room_t* r)
 uint32_t 
 room_photo_height (const room_t* r)
 {
-    return photo_height (r->view);
+    return photo_slot_height (r->view);
 }
 
 
@@ -847,15 +1057,85 @@ room_photo_height (const room_t* r)
 uint32_t 
 room_photo_width (const room_t* r)
 {
-    return photo_width (r->view);
+    return photo_slot_width (r->view);
+}
+
+
+/* 
+ * world_set_load_threads
+ *   DESCRIPTION: Set the number of threads used by build_world to read
+ *                image data.
+ *   INPUTS: n_threads -- number of threads, or 0 for one per processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+world_set_load_threads (int32_t n_threads)
+{
+    load_threads = n_threads;
+}
+
+
+/* 
+ * world_load_threads
+ *   DESCRIPTION: Get the number of threads used by build_world to read
+ *                image data.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of threads (at least 1)
+ *   SIDE EFFECTS: none
+ */
+int32_t
+world_load_threads ()
+{
+    return parallel_threads (load_threads);
+}
+
+
+/* 
+ * load_image
+ *   DESCRIPTION: Read one of the images needed by build_world.  Room
+ *                and swap photos get a slot, and are read only if all
+ *                photos are to be kept in memory (a budget of zero);
+ *                otherwise they are read when first shown.  Called from
+ *                several threads at once.
+ *   INPUTS: arg -- array of N_IMAGES image pointers (void**)
+ *           idx -- index of image in data order (room photos, object
+ *                  images, then swap photos)
+ *   OUTPUTS: arg[idx] -- the image or photo slot, or NULL on failure
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: dynamically allocates memory for the image
+ */
+static void
+load_image (void* arg, int32_t idx)
+{
+    void**        images = arg; /* images read so far */
+    photo_slot_t* slot;		/* slot for room photo */
+
+    if (N_ROOMS + N_OBJECTS > idx && N_ROOMS <= idx) {
+	images[idx] = read_obj_image (obj_data[idx - N_ROOMS].filename);
+	return;
+    }
+    slot = photo_slot_create (N_ROOMS > idx ? room_data[idx].filename :
+			      swap_data[idx - N_ROOMS - N_OBJECTS].filename);
+    if (NULL != slot && 0 == photo_store_budget () &&
+	0 != photo_slot_load (slot)) {
+	slot = NULL;
+    }
+    images[idx] = slot;
 }
 
 
 /* 
  * build_world
  *   DESCRIPTION: Builds and connects the rooms, creates objects, and 
- *                reads in all image data (could be done lazily with 
- *                caching instead).
+ *                reads in all image data (room photos are only read
+ *                here if no photo budget is set; see photo_store.h).
+ *                The images are all read first, in parallel on 
+ *                load_threads threads, and then linked into the world
+ *                in data order, so any error reported is the same one
+ *                that reading them one at a time would report.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: 1 on success, or 0 on failure
@@ -864,8 +1144,12 @@ room_photo_width (const room_t* r)
 int32_t
 build_world ()
 {
-    int32_t idx;	/* index over data arrays   */
-    int32_t which;	/* id for current data item */
+    int32_t idx;		/* index over data arrays   */
+    int32_t which;		/* id for current data item */
+    void*   images[N_IMAGES];	/* all images, in data order */
+
+    /* Read all of the images. */
+    parallel_for (N_IMAGES, load_threads, load_image, images);
 
     /* Clear all accomplishment flags. */
     (void)memset (player_flags, 0, sizeof (player_flags));
@@ -891,7 +1175,7 @@ build_world ()
 
 	/* Set up the room. */
         room[which].name = room_data[idx].name;
-	room[which].view = read_photo (room_data[idx].filename);
+	room[which].view = images[idx];
 	if (NULL == room[which].view) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     room_data[idx].filename);
@@ -927,7 +1211,7 @@ build_world ()
 
 	/* Set up the object. */
         object[which].name = obj_data[idx].name;
-	object[which].img = read_obj_image (obj_data[idx].filename);
+	object[which].img = images[N_ROOMS + idx];
 	if (NULL == object[which].img) {
 	    fprintf (stderr, "Can't read object photo %s.\n", 
 	    	     obj_data[idx].filename);
@@ -968,8 +1252,8 @@ build_world ()
 	    return 0;
 	}
 
-	/* Read in the swap photo. */
-	swap_photo[which] = read_photo (swap_data[idx].filename);
+	/* Set up the swap photo. */
+	swap_photo[which] = images[N_ROOMS + N_OBJECTS + idx];
 	if (NULL == swap_photo[which]) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     swap_data[idx].filename);
@@ -998,6 +1282,61 @@ start_in_room ()
 }
 
 
+/* 
+ * prefetch_neighbors
+ *   DESCRIPTION: Ask the photo store to read ahead the photos that may be
+ *                shown next: those of the rooms to the left, through the
+ *                door, and to the right, the alternate photo for a room
+ *                that may swap photos on entry (or, for the car, on a
+ *                command), and the other destinations of the 'go' 
+ *                command when the player is at one of them.
+ *   INPUTS: r -- the room that the player has just entered
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces any earlier prefetch requests
+ */
+void
+prefetch_neighbors (const room_t* r)
+{
+    static const int32_t go_rooms[] = {R_ALLERTON, R_WILLARD, R_CAR_SITE};
+    photo_slot_t* slots[8];	/* photos to be read ahead        */
+    int32_t       n_slots;	/* number of photos in slots      */
+    int32_t       idx;		/* index over 'go' destinations   */
+
+    n_slots = 0;
+    if (NULL != r->left) {
+	slots[n_slots++] = r->left->view;
+    }
+    if (NULL != r->enter) {
+	slots[n_slots++] = r->enter->view;
+    }
+    if (NULL != r->right) {
+	slots[n_slots++] = r->right->view;
+    }
+
+    /* The Boneyard Circle chooses a picture randomly on entry. */
+    if (&room[R_CIRCLE_N] == r->left || &room[R_CIRCLE_N] == r->enter ||
+	&room[R_CIRCLE_N] == r->right) {
+	slots[n_slots++] = swap_photo[SWAP_CIRCLE];
+    }
+
+    /* The car photo changes when the car is opened or fixed. */
+    if (&room[R_CAR_SITE] == r) {
+	slots[n_slots++] = swap_photo[SWAP_CAR];
+    }
+
+    /* The 'go' command travels among a few distant rooms. */
+    for (idx = 0; 3 > idx; idx++) {
+	if (&room[go_rooms[idx]] == r) {
+	    slots[n_slots++] = room[go_rooms[(idx + 1) % 3]].view;
+	    slots[n_slots++] = room[go_rooms[(idx + 2) % 3]].view;
+	}
+    }
+
+    photo_store_prefetch (slots, n_slots);
+}
+
+
 /* 
  * player_has_board
  *   DESCRIPTION: Check whether the player has the board in inventory.
@@ -39,12 +39,26 @@
 #include "types.h"
 
 
+/*
+ * The objects in a room are indexed by bands of OBJ_BAND_SIZE rows and
+ * of OBJ_BAND_SIZE columns of the room photo.  All rows (or columns) in
+ * one band share the same list from room_objects_on_row (or 
+ * room_objects_on_column).
+ */
+#define OBJ_BAND_SHIFT 5
+#define OBJ_BAND_SIZE  (1 << OBJ_BAND_SHIFT)
+
+
 /* structure access functions */
 extern uint16_t obj_get_x (const object_t* obj);
 extern uint16_t obj_get_y (const object_t* obj);
 extern image_t* obj_image (const object_t* obj);
 extern object_t* obj_next (const object_t* obj);
 extern object_t* room_contents_iterate (const room_t* r);
+extern int32_t room_objects_on_row (const room_t* r, int32_t y,
+				    object_t* const** objs);
+extern int32_t room_objects_on_column (const room_t* r, int32_t x,
+				       object_t* const** objs);
 extern const char* room_name (const room_t* r);
 extern photo_t* room_photo (const room_t* r);
 extern uint32_t room_photo_height (const room_t* r);
@@ -53,9 +67,25 @@ extern uint32_t room_photo_width (const room_t* r);
 /* Build the game world.  Returns 0 on failure, or 1 on success. */
 extern int32_t build_world (void);
 
+/* 
+ * threads used by build_world to read images (0 for one per processor);
+ * override with -DLOAD_THREADS=n when compiling, or at run time
+ */
+#if !defined(LOAD_THREADS)
+#define LOAD_THREADS 0
+#endif
+extern void world_set_load_threads (int32_t n_threads);
+extern int32_t world_load_threads (void);
+
 /* Get pointer to starting room for player. */
 extern room_t* start_in_room (void);
 
+/* 
+ * Start reading, in the background, the photos of rooms that the player
+ * can reach from room r with one move or command.
+ */
+extern void prefetch_neighbors (const room_t* r);
+
 /*
  * checks for accelerator object ownership; these make horizontal (board)
  * and vertical (jetpack) pixel panning faster